@@ -345,6 +345,12 @@ public class Panel : Gtk.Window
         // prevent masses of size allocates
         stored_y = stored_width = stored_height = stored_x = 0;
         master_layout.show();
+        ulong map_id = 0;
+        map_id = map_event.connect(()=> {
+            SignalHandler.disconnect(this, map_id);
+            trace_mark("budgie-panel: mapped");
+            return false;
+        });
         show();
 
         // post config/extension loading routine, ensure we dynamically load at runtime
@@ -1170,6 +1176,28 @@ public class Panel : Gtk.Window
     }
 
 
+    /**
+     * Report a startup milestone to budgie-session's startup trace, if
+     * we're running under it
+     */
+    protected void trace_mark(string mark)
+    {
+        Bus.get.begin(BusType.SESSION, null, (obj, res)=> {
+            try {
+                var conn = Bus.get.end(res);
+                var args = new Variant.tuple({
+                    new Variant.string("trace-mark"),
+                    new Variant.array(VariantType.VARIANT, { new Variant.variant(new Variant.string(mark)) }),
+                    new Variant.array(new VariantType("{sv}"), {})
+                });
+                conn.call.begin("com.evolve_os.BudgieSession", "/com/evolve_os/BudgieSession",
+                    "org.gtk.Actions", "Activate", args, null, DBusCallFlags.NO_AUTO_START, -1, null);
+            } catch (Error e) {
+                /* No session bus, no session to tell */
+            }
+        });
+    }
+
     /* Inform a given applet the new maximum icon size */
     protected void inform_size(Applet applet)
     {
@@ -58,18 +58,26 @@ public class PanelMover : Object
     // Track open windows, overlaps, etc.
     Wnck.Screen wnck_screen;
 
+    /* Maximized windows on the primary monitor, on any workspace */
+    HashTable<unowned Wnck.Window,unowned Wnck.Window> maximized;
+    /* Those of them visible right now, the panel is darker while any are */
+    HashTable<unowned Wnck.Window,unowned Wnck.Window> visible_maximized;
+
     public PanelMover(Budgie.Panel? panel) {
         this.panel = panel;
 
         var primary_monitor = panel.screen.get_primary_monitor();
         panel.screen.get_monitor_geometry(primary_monitor, out primary_monitor_rect);
 
+        maximized = new HashTable<unowned Wnck.Window,unowned Wnck.Window>(direct_hash, direct_equal);
+        visible_maximized = new HashTable<unowned Wnck.Window,unowned Wnck.Window>(direct_hash, direct_equal);
+
         // set up wnck
         Wnck.set_client_type(Wnck.ClientType.PAGER);
         wnck_screen = Wnck.Screen.get_default();
         wnck_screen.window_opened.connect(on_window_opened);
         wnck_screen.window_closed.connect(on_window_closed);
-        wnck_screen.active_window_changed.connect(on_active_window_changed);
+        wnck_screen.active_workspace_changed.connect(on_active_workspace_changed);
 
         panel.enter_notify_event.connect(on_panel_enter);
         panel.leave_notify_event.connect(on_panel_leave);
@@ -317,67 +325,103 @@ public class PanelMover : Object
     }
 
     /*
-     * WNCK stuff follows, simply to update the panel background
+     * WNCK stuff follows, simply to update the panel background. Windows
+     * are only looked at when something about them changes, so the panel
+     * style itself is decided without walking the window list.
      */
     protected void on_window_opened(Wnck.Window window)
     {
-        ulong id = window.state_changed.connect(on_window_state_changed);
-        window.set_data("__bid", id);
-        update_panel_state();
+        window.state_changed.connect(on_window_state_changed);
+        window.geometry_changed.connect(on_window_changed);
+        window.workspace_changed.connect(on_window_changed);
+        update_window(window);
     }
 
     protected void on_window_closed(Wnck.Window window)
     {
         // quicker than waiting on GC.
-        ulong id = window.get_data("__bid");
-        window.disconnect(id);
+        window.state_changed.disconnect(on_window_state_changed);
+        window.geometry_changed.disconnect(on_window_changed);
+        window.workspace_changed.disconnect(on_window_changed);
+
+        maximized.remove(window);
+        visible_maximized.remove(window);
         update_panel_state();
     }
 
-    protected void on_active_window_changed(Wnck.Window? prev_window)
+    protected void on_active_workspace_changed(Wnck.Workspace? prev_workspace)
     {
+        /* Only the maximized windows can change the outcome */
+        visible_maximized.remove_all();
+        foreach (var window in maximized.get_keys()) {
+            if (is_visible(window)) {
+                visible_maximized.insert(window, window);
+            }
+        }
         update_panel_state();
     }
 
-    protected void on_window_state_changed(Wnck.WindowState mask, Wnck.WindowState new_state)
+    protected void on_window_state_changed(Wnck.Window window, Wnck.WindowState mask, Wnck.WindowState new_state)
     {
-        update_panel_state();
+        update_window(window);
     }
 
-    protected void update_panel_state()
+    protected void on_window_changed(Wnck.Window window)
     {
-        int wx, wy, ww, wh; // wnck out vars
+        update_window(window);
+    }
 
-        bool havemax = false;
+    protected bool is_visible(Wnck.Window window)
+    {
         // Might not have a workspace. Shrug. Revisit if/when it becomes a problem
         Wnck.Workspace? workspace = wnck_screen.get_active_workspace();
-        foreach (var window in wnck_screen.get_windows()) {
-            bool subvis = false;
+        if (workspace != null) {
+            return window.is_visible_on_workspace(workspace);
+        }
+        return !window.is_minimized() && !window.is_shaded();
+    }
 
-            window.get_client_window_geometry(out wx, out wy, out ww, out wh);
+    protected bool is_maximized_on_primary(Wnck.Window window)
+    {
+        int wx, wy, ww, wh; // wnck out vars
 
-            if (workspace != null) {
-                subvis = window.is_visible_on_workspace(workspace);
+        if (!window.is_maximized_vertically()) {
+            return false;
+        }
+        window.get_client_window_geometry(out wx, out wy, out ww, out wh);
+
+        // ensure that the window is fully contained within the
+        // primary monitor as maximizing a window on other
+        // monitors should not affect the shading of the bar
+        return wx >= primary_monitor_rect.x &&
+            wx <= primary_monitor_rect.x + primary_monitor_rect.width &&
+            wy >= primary_monitor_rect.y &&
+            wy <= primary_monitor_rect.y + primary_monitor_rect.height;
+    }
+
+    /**
+     * Bring a single window's membership of the maximized sets up to date
+     */
+    protected void update_window(Wnck.Window window)
+    {
+        if (!is_maximized_on_primary(window)) {
+            maximized.remove(window);
+            visible_maximized.remove(window);
+        } else {
+            maximized.insert(window, window);
+            if (is_visible(window)) {
+                visible_maximized.insert(window, window);
             } else {
-                if (!window.is_minimized() && !window.is_shaded()) {
-                    subvis = true;
-                }
-            }
-            if (window.is_maximized_vertically() && subvis &&
-                // ensure that the window is fully contained within the
-                // primary monitor as maximizing a window on other
-                // monitors should not affect the shading of the bar
-                wx >= primary_monitor_rect.x &&
-                wx <= primary_monitor_rect.x + primary_monitor_rect.width &&
-                wy >= primary_monitor_rect.y &&
-                wy <= primary_monitor_rect.y + primary_monitor_rect.height
-            ) {
-                havemax = true;
-                break;
+                visible_maximized.remove(window);
             }
         }
+        update_panel_state();
+    }
+
+    protected void update_panel_state()
+    {
         // Set the max-budgie-panel style, i.e. a darker panel :)
-        if (havemax) {
+        if (visible_maximized.size() > 0) {
             panel.get_style_context().add_class("max-budgie-panel");
         } else {
             panel.get_style_context().remove_class("max-budgie-panel");
@@ -50,44 +50,55 @@ public class CategoryButton : Gtk.RadioButton
 }
 
 /**
- * Factory widget to represent a menu item
+ * Recyclable row widget, bound to one menu entry at a time
  */
 public class MenuButton : Gtk.Button
 {
 
-    public unowned DesktopAppInfo info { public get ; protected set ; }
-    public unowned GMenu.TreeDirectory parent_menu { public get ; protected set ; }
+    public MenuSnapshotEntry? entry { public get ; protected set ; default = null; }
 
-    public int score { public set ; public get; }
+    private Gtk.Image img;
+    private Gtk.Label lab;
+    private int icon_size;
 
-    public MenuButton(DesktopAppInfo parent, GMenu.TreeDirectory directory, int icon_size)
+    public MenuButton(int icon_size)
     {
-        var img = new Gtk.Image.from_gicon(parent.get_icon(), Gtk.IconSize.INVALID);
+        this.icon_size = icon_size;
+        img = new Gtk.Image();
         img.pixel_size = icon_size;
-        var lab = new Gtk.Label(parent.get_display_name());
+        lab = new Gtk.Label("");
         lab.set_alignment(0.0f, 0.5f);
+        lab.set_ellipsize(Pango.EllipsizeMode.END);
 
         var layout = new Gtk.Box(Gtk.Orientation.HORIZONTAL, 5);
         layout.pack_start(img, false, false, 5);
         layout.pack_start(lab, true, true, 0);
         add(layout);
 
-        this.info = parent;
-        this.parent_menu = directory;
-        set_tooltip_text(parent.get_description());
-
-        score = 0;
-
         relief = Gtk.ReliefStyle.NONE;
     }
+
+    /**
+     * Display the given entry in this row
+     */
+    public void bind(MenuSnapshotEntry entry)
+    {
+        if (this.entry == entry) {
+            return;
+        }
+        this.entry = entry;
+        Budgie.IconCache.set_image_from_gicon(img, entry.info.get_icon(), icon_size);
+        lab.set_label(entry.display_name);
+        set_tooltip_text(entry.description);
+    }
 }
 
 public class BudgieMenuWindow : Budgie.Popover
 {
     protected Gtk.SearchEntry search_entry;
     protected Gtk.Box categories;
-    protected Gtk.ListBox content;
-    private GMenu.Tree tree;
+    protected MenuListView content;
+    private GMenu.Tree? tree = null;
     protected Gtk.ScrolledWindow categories_scroll;
     protected Gtk.ScrolledWindow content_scroll;
     protected CategoryButton all_categories;
@@ -97,95 +108,98 @@ public class BudgieMenuWindow : Budgie.Popover
     protected GMenu.TreeDirectory? group = null;
 
     protected Settings settings;
+    protected unowned Budgie.UsageStore usage;
     protected bool compact_mode;
 
-    // Current search term
+    // Current search term, normalized
     protected string search_term = "";
+    protected MenuSearchIndex? search_index = null;
 
     protected int icon_size = 22;
 
+    /* Background loading state */
+    private bool loading = false;
+    private bool reload_pending = false;
+    private ulong tree_changed_id = 0;
+
+    /* Entries of the current snapshot */
+    private GenericArray<MenuSnapshotEntry>? entries = null;
+
     /* Reload menus, essentially. */
     public void refresh_tree()
     {
-        foreach (var child in content.get_children()) {
-            child.destroy();
-        }
-        foreach (var child in categories.get_children()) {
-            if (child != all_categories) {
-                child.destroy();
-            }
-        }
-        try {
-            tree.load_sync();
-        } catch (Error e) {
-            stderr.printf("Error: %s\n", e.message);
-        }
-        load_menus(null);
-        apply_scores();
+        start_load();
     }
 
     /**
-     * Load "menus" (.desktop's) recursively (ripped from our RunDialog)
-     * 
-     * @param tree_root Initialised GMenu.TreeDirectory, or null
+     * Load and flatten the menu tree on a worker thread. Only the finished
+     * snapshot is handed back to the main loop.
      */
-    private void load_menus(GMenu.TreeDirectory? tree_root = null)
+    protected void start_load()
     {
-        GMenu.TreeDirectory root;
-    
-        // Load the tree for the first time
-        if (tree == null) {
-            tree = new GMenu.Tree(APPS_ID, GMenu.TreeFlags.SORT_DISPLAY_NAME);
+        if (loading) {
+            /* Pick it up again once the current load lands */
+            reload_pending = true;
+            return;
+        }
+        loading = true;
+        reload_pending = false;
+
+        new Thread<void*>("budgie-menu-loader", ()=> {
+            var snapshot = MenuSnapshot.build();
+            Idle.add(()=> {
+                loading = false;
+                if (snapshot != null) {
+                    apply_snapshot(snapshot);
+                }
+                if (reload_pending) {
+                    start_load();
+                }
+                return false;
+            });
+            return null;
+        });
+    }
 
-            try {
-                tree.load_sync();
-            } catch (Error e) {
-                stderr.printf("Error: %s\n", e.message);
-                return;
+    /**
+     * Replace the current menu contents with those from the snapshot. No
+     * rows are created here, the list only realizes what is in view.
+     */
+    protected void apply_snapshot(MenuSnapshot snapshot)
+    {
+        content.set_model(null);
+        group = null;
+        all_categories.set_active(true);
+        foreach (var child in categories.get_children()) {
+            if (child != all_categories) {
+                child.destroy();
             }
-            tree.changed.connect(refresh_tree);
-        }
-        if (tree_root == null) {
-            root = tree.get_root_directory();
-        } else {
-            root = tree_root;
         }
 
-        var it = root.iter();
-        GMenu.TreeItemType? type;
-
-        while ((type = it.next()) != GMenu.TreeItemType.INVALID) {
-            if (type == GMenu.TreeItemType.DIRECTORY) {
-                var dir = it.get_directory();
-                var btn = new CategoryButton(dir, icon_size);
-                btn.join_group(all_categories);
-                categories.pack_start(btn, false, false, 0);
-
-                // Ensures we find the correct button
-                btn.toggled.connect(()=>{
-                    update_category(btn);
-                });
-
-                load_menus(dir);
-            } else if (type == GMenu.TreeItemType.ENTRY) {
-                // store the entry by its command line (without path)
-                var appinfo = it.get_entry().get_app_info();
-                if (tree_root == null) {
-                    warning("%s has no parent directory, not adding to menu\n", appinfo.get_display_name());
-                } else {
-                    var btn = new MenuButton(appinfo, tree_root, icon_size);
-                    btn.clicked.connect(()=> {
-                        hide();
-                        btn.score++;
-                        launch_app(btn.info);
-                        content.invalidate_sort();
-                        content.invalidate_headers();
-                        save_scores();
-                    });
-                    content.add(btn);
-                }
-            }
+        /* Buttons only hold unowned directories, so swap the tree last */
+        if (tree != null && tree_changed_id > 0) {
+            SignalHandler.disconnect(tree, tree_changed_id);
         }
+        tree = snapshot.tree;
+        tree_changed_id = tree.changed.connect(refresh_tree);
+        search_index = snapshot.index;
+        search_index.search(search_term);
+        entries = snapshot.entries;
+
+        for (int i = 0; i < snapshot.categories.length; i++) {
+            var btn = new CategoryButton(snapshot.categories[i], icon_size);
+            btn.join_group(all_categories);
+            categories.pack_start(btn, false, false, 0);
+
+            // Ensures we find the correct button
+            btn.toggled.connect(()=>{
+                update_category(btn);
+            });
+            btn.show_all();
+        }
+
+        apply_scores();
+        content.set_model(entries);
     }
 
     protected void unwrap_score(Variant v, out string s, out int i)
@@ -196,68 +210,31 @@ public class BudgieMenuWindow : Budgie.Popover
         i = t.get_int32();
     }
 
-    /* Apply "scores" to enable usage-sorting */
-    protected void apply_scores()
+    /**
+     * Seed the usage store from the old "app-scores" launch counters, once
+     */
+    protected void import_legacy_scores()
     {
+        if (usage.exists) {
+            return;
+        }
         var scores = settings.get_value("app-scores");
-
-        HashTable<string,int> m = new HashTable<string,int>(str_hash, str_equal);
-
-        /* Prevent large loops by caching score items */
         for (int i = 0; i < scores.n_children(); i++) {
-            var tupe = scores.get_child_value(i);
             string dname; int score;
-            unwrap_score(tupe, out dname, out score);
-
-            m.insert(dname, score);
+            unwrap_score(scores.get_child_value(i), out dname, out score);
+            usage.import_score(dname, score);
         }
-
-        foreach (var sprog in content.get_children()) {
-            MenuButton child = (sprog as Gtk.Bin).get_child() as MenuButton;
-            var key = child.info.get_filename();
-            if (m.contains(key)) {
-                child.score = m.get(key);
-            }
-        }
-
-        content.invalidate_sort();
-    }
-
-    protected Variant mktuple(string text, int val)
-    {
-        Variant l = new Variant.string(text);
-        Variant r = new Variant.int32(val);
-        Variant t = new Variant.tuple(new Variant[] { l, r});
-
-        return t;
     }
 
-    /* Save "scores" (usage-sorting */
-    protected void save_scores()
+    /* Apply "scores" to enable usage-sorting */
+    protected void apply_scores()
     {
-
-        Variant[] children = null;
-
-        foreach (var sprog in content.get_children()) {
-            MenuButton child = (sprog as Gtk.Bin).get_child() as MenuButton;
-            if (child.score == 0) {
-                continue;
-            }
-            var key = child.info.get_filename();
-            var tuple = mktuple(key, child.score);
-            if (children == null) {
-                children = new Variant[] { tuple };
-            } else {
-                children += tuple;
-            }
-        }
-
-        if (children == null) {
+        if (entries == null) {
             return;
         }
-        var arr = new Variant.array(null, children);
-        settings.set_value("app-scores", arr);
-
+        for (int i = 0; i < entries.length; i++) {
+            entries[i].score = usage.get_score(entries[i].info.get_filename());
+        }
     }
 
     public BudgieMenuWindow()
@@ -271,6 +248,14 @@ public class BudgieMenuWindow : Budgie.Popover
         settings = new Settings("com.evolve-os.budgie.panel");
         icon_size = settings.get_int("menu-icons-size");
 
+        // Loaded up front, so the first sort is already by usage
+        usage = Budgie.UsageStore.get_default();
+        import_legacy_scores();
+        usage.changed.connect(()=> {
+            apply_scores();
+            content.invalidate();
+        });
+
         // search entry up north
         search_entry = new Gtk.SearchEntry();
         master_layout.pack_start(search_entry, false, false, 0);
@@ -301,35 +286,40 @@ public class BudgieMenuWindow : Budgie.Popover
         middle.pack_start(right_layout, true, true, 0);
 
         // holds all the applications
-        content = new Gtk.ListBox();
-        content.row_activated.connect(on_row_activate);
+        content = new MenuListView(icon_size);
+        content.entry_activated.connect(launch_entry);
         content_scroll = new Gtk.ScrolledWindow(null, null);
         content_scroll.set_policy(Gtk.PolicyType.NEVER, Gtk.PolicyType.AUTOMATIC);
         content_scroll.add(content);
         right_layout.pack_start(content_scroll, true, true, 0);
 
-        // placeholder in case of no results
-        var placeholder = new Gtk.Label("<big>Sorry, no items found</big>");
-        placeholder.use_markup = true;
-        placeholder.show();
-        placeholder.margin = 6;
-        content.halign = Gtk.Align.START;
-        content.valign = Gtk.Align.START;
-        content.set_placeholder(placeholder);
-
         settings.changed.connect(on_settings_changed);
         on_settings_changed("menu-compact");
         on_settings_changed("menu-headers");
 
-        // management of our listbox
+        // management of our list
         content.set_filter_func(do_filter_list);
         content.set_sort_func(do_sort_list);
 
+        // keyboard navigation of the results from the search entry
+        search_entry.key_press_event.connect((e)=> {
+            if (e.keyval == Gdk.Key.Down) {
+                content.move_selection(1);
+                return Gdk.EVENT_STOP;
+            } else if (e.keyval == Gdk.Key.Up) {
+                content.move_selection(-1);
+                return Gdk.EVENT_STOP;
+            }
+            return Gdk.EVENT_PROPAGATE;
+        });
+
         // searching functionality :)
         search_entry.changed.connect(()=> {
-            search_term = search_entry.text.down();
-            content.invalidate_headers();
-            content.invalidate_filter();
+            search_term = MenuSearchIndex.normalize(search_entry.text);
+            if (search_index != null) {
+                search_index.search(search_term);
+            }
+            content.invalidate();
         });
 
         search_entry.set_can_default(true);
@@ -343,11 +333,7 @@ public class BudgieMenuWindow : Budgie.Popover
         // sensible vertical height
         set_size_request(300, 510);
         // load them in the background
-        Idle.add(()=> {
-            load_menus(null);
-            apply_scores();
-            return false;
-        });
+        start_load();
     }
 
     protected void on_settings_changed(string key)
@@ -367,7 +353,6 @@ public class BudgieMenuWindow : Budgie.Popover
                 } else {
                     content.set_header_func(null);
                 }
-                content.invalidate_headers();
                 break;
             default:
                 // not interested
@@ -378,125 +363,54 @@ public class BudgieMenuWindow : Budgie.Popover
 
     protected void on_entry_activate()
     {
-        Gtk.ListBoxRow? selected = null;
-
-        foreach (var child in content.get_children()) {
-            if (child.get_visible() && child.get_child_visible()) {
-                selected = child as Gtk.ListBoxRow;
-                break;
-            }
-        }
-        if (selected == null) {
+        var entry = content.get_selected_entry();
+        if (entry == null) {
             return;
         }
-
-        MenuButton btn = selected.get_child() as MenuButton;
-        btn.score++;
-        launch_app(btn.info);
-        content.invalidate_sort();
-        content.invalidate_headers();
-        save_scores();
+        launch_entry(entry);
     }
 
-    protected void on_row_activate(Gtk.ListBoxRow? row)
+    /**
+     * Launch an entry and bump its usage score
+     */
+    protected void launch_entry(MenuSnapshotEntry entry)
     {
-        if (row == null) {
-            return;
-        }
-        /* Launch this item, i.e. keyboard access. */
-        MenuButton btn = row.get_child() as MenuButton;
-        btn.score++;
-        launch_app(btn.info);
-        content.invalidate_sort();
-        content.invalidate_headers();
-        save_scores();
+        launch_app(entry.info);
+        /* Re-sorts via the store's changed signal */
+        usage.record_launch(entry.info.get_filename());
     }
 
     /**
      * Provide category headers in the "All" category
      */
-    protected void do_list_header(Gtk.ListBoxRow? before, Gtk.ListBoxRow? after)
+    protected string? do_list_header(MenuSnapshotEntry? before, MenuSnapshotEntry entry)
     {
-        MenuButton? child = null;
-        string? prev = null;
-        string? next = null;
-
         // In a category listing, kill headers
         if (group != null) {
-            if (before != null) {
-                before.set_header(null);
-            }
-            if (after != null) {
-                after.set_header(null);
-            }
-            return;
+            return null;
         }
 
-        // Just retrieve the category names
-        if (before != null) {
-            child = before.get_child() as MenuButton;
-            prev = child.parent_menu.get_name();
-        }
-
-        if (after != null) {
-            child = after.get_child() as MenuButton;
-            next = child.parent_menu.get_name();
-        }
-        
         // Only add one if we need one!
-        if (before == null || after == null || prev != next) {
-            var label = new Gtk.Label(Markup.printf_escaped("<big>%s</big>", prev));
-            label.get_style_context().add_class("dim-label");
-            label.halign = Gtk.Align.START;
-            label.use_markup = true;
-            before.set_header(label);
-            label.margin = 6;
-        } else {
-            before.set_header(null);
+        if (before == null || before.directory != entry.directory) {
+            return entry.directory.get_name();
         }
+        return null;
     }
 
     /**
      * Filter out results in the list according to whatever the current filter is,
      * i.e. group based or search based
      */
-    protected bool do_filter_list(Gtk.ListBoxRow row)
+    protected bool do_filter_list(MenuSnapshotEntry child)
     {
-        MenuButton child = row.get_child() as MenuButton;
-
         if (search_term.length > 0) {
-            string? app_name, desc, name, exec;
-
             // "disable" categories while searching
             categories.sensitive = false;
 
-            // Ugly and messy but we need to ensure we're not dealing with NULL strings
-            app_name = child.info.get_display_name();
-            if (app_name != null) {
-                app_name = app_name.down();
-            } else {
-                app_name = "";
-            }
-            desc = child.info.get_description();
-            if (desc != null) {
-                desc = desc.down();
-            } else {
-                desc = "";
+            if (search_index == null) {
+                return false;
             }
-            name = child.info.get_name();
-            if (name != null) {
-                name = name.down();
-            } else {
-                name = "";
-            };
-            exec = child.info.get_executable();
-            if (exec != null) {
-                exec = exec.down();
-            } else {
-                exec = "";
-            }
-            return (search_term in app_name || search_term in desc ||
-                    search_term in name || search_term in exec);
+            return search_index.ranks[child.position] != MatchQuality.NONE;
         }
 
         // "enable" categories if not searching
@@ -507,16 +421,22 @@ public class BudgieMenuWindow : Budgie.Popover
             return true;
         }
         // If the GMenu.TreeDirectory isn't the same as the current filter, hide it
-        if (child.parent_menu != group) {
+        if (child.directory != group) {
             return false;
         }
         return true;
     }
 
-    protected int do_sort_list(Gtk.ListBoxRow row1, Gtk.ListBoxRow row2)
+    protected int do_sort_list(MenuSnapshotEntry child1, MenuSnapshotEntry child2)
     {
-        MenuButton child1 = row1.get_child() as MenuButton;
-        MenuButton child2 = row2.get_child() as MenuButton;
+        // Searching, better matches first, then usage
+        if (search_term.length > 0 && search_index != null) {
+            var rank1 = search_index.ranks[child1.position];
+            var rank2 = search_index.ranks[child2.position];
+            if (rank1 != rank2) {
+                return rank1 > rank2 ? -1 : 1;
+            }
+        }
 
         int run = 0;
         if (child1.score > child2.score) {
@@ -536,8 +456,7 @@ public class BudgieMenuWindow : Budgie.Popover
     {
         if (btn.active) {
             group = btn.group;
-            content.invalidate_filter();
-            content.invalidate_headers();
+            content.invalidate();
         }
     }
 
@@ -568,8 +487,7 @@ public class BudgieMenuWindow : Budgie.Popover
         search_entry.text = "";
         group = null;
         all_categories.set_active(true);
-        content.select_row(null);
-        content_scroll.get_vadjustment().set_value(0);
+        content.reset_view();
         categories_scroll.get_vadjustment().set_value(0);
         categories.sensitive = true;
         Idle.add(()=> {
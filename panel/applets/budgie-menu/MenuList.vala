@@ -0,0 +1,452 @@
+/*
+ * MenuList.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * Width requested by the application list. Rows ellipsize beyond this.
+ */
+const int MENU_LIST_WIDTH = 250;
+
+/* Offset a child was last moved to, plus one so that 0 means never */
+const string MENU_LIST_Y_KEY = "budgie-menu-list-y";
+
+/**
+ * Decide whether an entry is shown
+ */
+public delegate bool MenuListFilterFunc(MenuSnapshotEntry entry);
+
+/**
+ * Order two entries, as per CompareFunc
+ */
+public delegate int MenuListSortFunc(MenuSnapshotEntry a, MenuSnapshotEntry b);
+
+/**
+ * Return the header to show above entry, or null for none
+ *
+ * @param before The previous visible entry, or null if entry is first
+ */
+public delegate string? MenuListHeaderFunc(MenuSnapshotEntry? before, MenuSnapshotEntry entry);
+
+/**
+ * Virtualized list of menu entries.
+ *
+ * Filtering and sorting happen on the MenuSnapshotEntry model. Only the
+ * rows (and headers) intersecting the visible area exist as widgets, and
+ * these are recycled as the list scrolls.
+ */
+public class MenuListView : Gtk.Layout
+{
+
+    /* The model, and its filtered + sorted view */
+    GenericArray<MenuSnapshotEntry>? model = null;
+    MenuSnapshotEntry[] visible = {};
+    string?[] headers = {};
+    int[] offsets = {};
+    int total_height = 0;
+
+    MenuListFilterFunc? filter_func = null;
+    MenuListSortFunc? sort_func = null;
+    MenuListHeaderFunc? header_func = null;
+
+    /* Realized rows by entry, plus the spare ones */
+    HashTable<MenuSnapshotEntry,MenuButton> bound;
+    GenericArray<MenuButton> spare_rows;
+    GenericArray<Gtk.Label> header_pool;
+    Gtk.Label placeholder;
+
+    int row_height = 0;
+    int header_height = 0;
+    int icon_size;
+    ulong vadjustment_id = 0;
+    ulong page_id = 0;
+    unowned Gtk.Adjustment? watched = null;
+
+    /* Index of the selected entry within the visible entries, or -1 */
+    public int selected { public get; private set; default = -1; }
+
+    /**
+     * Emitted when a row is clicked
+     */
+    public signal void entry_activated(MenuSnapshotEntry entry);
+
+    public MenuListView(int icon_size)
+    {
+        Object();
+        this.icon_size = icon_size;
+
+        bound = new HashTable<MenuSnapshotEntry,MenuButton>(direct_hash, direct_equal);
+        spare_rows = new GenericArray<MenuButton>();
+        header_pool = new GenericArray<Gtk.Label>();
+
+        // placeholder in case of no results
+        placeholder = new Gtk.Label("<big>Sorry, no items found</big>");
+        placeholder.use_markup = true;
+        placeholder.margin = 6;
+        placeholder.no_show_all = true;
+        put(placeholder, 0, 0);
+
+        set_size_request(MENU_LIST_WIDTH, -1);
+        notify["vadjustment"].connect(watch_adjustment);
+        watch_adjustment();
+    }
+
+    void watch_adjustment()
+    {
+        if (watched != null && vadjustment_id > 0) {
+            SignalHandler.disconnect(watched, vadjustment_id);
+            SignalHandler.disconnect(watched, page_id);
+            vadjustment_id = 0;
+            page_id = 0;
+        }
+        watched = get_vadjustment();
+        if (watched != null) {
+            vadjustment_id = watched.value_changed.connect(update_visible);
+            /* Page size follows our allocation, i.e. when first shown */
+            page_id = watched.changed.connect(update_visible);
+        }
+    }
+
+    public void set_filter_func(owned MenuListFilterFunc? func)
+    {
+        filter_func = (owned)func;
+        invalidate();
+    }
+
+    public void set_sort_func(owned MenuListSortFunc? func)
+    {
+        sort_func = (owned)func;
+        invalidate();
+    }
+
+    public void set_header_func(owned MenuListHeaderFunc? func)
+    {
+        header_func = (owned)func;
+        invalidate();
+    }
+
+    /**
+     * Replace the model entirely, i.e. after a menu reload
+     */
+    public void set_model(GenericArray<MenuSnapshotEntry>? model)
+    {
+        foreach (var row in bound.get_values()) {
+            row.hide();
+            spare_rows.add(row);
+        }
+        bound.remove_all();
+        this.model = model;
+        selected = -1;
+        invalidate();
+    }
+
+    /**
+     * Rebuild the visible view of the model. This only ever touches the
+     * plain entries, never the row widgets.
+     */
+    public void invalidate()
+    {
+        MenuSnapshotEntry? selected_entry = null;
+        if (selected >= 0 && selected < visible.length) {
+            selected_entry = visible[selected];
+        }
+
+        var view = new GenericArray<MenuSnapshotEntry>();
+        if (model != null) {
+            for (int i = 0; i < model.length; i++) {
+                var entry = model[i];
+                if (filter_func == null || filter_func(entry)) {
+                    view.add(entry);
+                }
+            }
+        }
+        if (sort_func != null) {
+            view.sort_with_data((a, b)=> {
+                var ret = sort_func(a, b);
+                /* Keep it stable, tree order for equal items */
+                if (ret == 0) {
+                    ret = a.position - b.position;
+                }
+                return ret;
+            });
+        }
+
+        visible = new MenuSnapshotEntry[view.length];
+        headers = new string?[view.length];
+        for (int i = 0; i < view.length; i++) {
+            visible[i] = view[i];
+            if (header_func != null) {
+                headers[i] = header_func(i > 0 ? view[i-1] : null, view[i]);
+            }
+        }
+        /* Follow the selected entry, not its old index, so Enter never
+         * launches whatever happened to move into its place */
+        selected = -1;
+        for (int i = 0; i < visible.length && selected_entry != null; i++) {
+            if (visible[i] == selected_entry) {
+                selected = i;
+                break;
+            }
+        }
+        placeholder.set_visible(visible.length == 0);
+
+        layout_entries();
+        update_visible();
+    }
+
+    /**
+     * Compute the y offset of every visible entry
+     */
+    void layout_entries()
+    {
+        measure();
+        offsets = new int[visible.length];
+        int y = 0;
+        for (int i = 0; i < visible.length; i++) {
+            if (headers[i] != null) {
+                y += header_height;
+            }
+            offsets[i] = y;
+            y += row_height;
+        }
+        total_height = y;
+        set_size(MENU_LIST_WIDTH, total_height);
+    }
+
+    /**
+     * Determine row and header heights from a sample of each
+     */
+    void measure()
+    {
+        if (row_height > 0 || get_screen() == null) {
+            return;
+        }
+        int min;
+        int nat;
+        var row = acquire_row();
+        row.get_preferred_height(out min, out nat);
+        row_height = int.max(nat, 1);
+        spare_rows.add(row);
+
+        var header = acquire_header(0);
+        header.set_markup(Markup.printf_escaped("<big>%s</big>", "Mg"));
+        header.get_preferred_height(out min, out nat);
+        header_height = nat;
+        header.hide();
+    }
+
+    MenuButton acquire_row()
+    {
+        MenuButton row;
+        if (spare_rows.length > 0) {
+            row = spare_rows[spare_rows.length - 1];
+            spare_rows.remove_index(spare_rows.length - 1);
+            return row;
+        }
+        row = new MenuButton(icon_size);
+        row.clicked.connect(()=> {
+            if (row.entry != null) {
+                entry_activated(row.entry);
+            }
+        });
+        put(row, 0, 0);
+        return row;
+    }
+
+    Gtk.Label acquire_header(int n)
+    {
+        while (header_pool.length <= n) {
+            var label = new Gtk.Label("");
+            label.get_style_context().add_class("dim-label");
+            label.halign = Gtk.Align.START;
+            label.use_markup = true;
+            label.margin = 6;
+            label.no_show_all = true;
+            header_pool.add(label);
+            put(label, 0, 0);
+        }
+        return header_pool[n];
+    }
+
+    /**
+     * Find the first visible index whose row ends below y
+     */
+    int index_at(int y)
+    {
+        int lo = 0;
+        int hi = visible.length;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (offsets[mid] + row_height <= y) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /**
+     * Bind rows to the entries currently in view, recycling the rest
+     */
+    public void update_visible()
+    {
+        if (row_height == 0) {
+            layout_entries();
+            if (row_height == 0) {
+                return;
+            }
+        }
+        var adj = get_vadjustment();
+        int top = adj != null ? (int)adj.value : 0;
+        int height = adj != null && adj.page_size > 0 ? (int)adj.page_size : get_allocated_height();
+        int bottom = top + height;
+
+        int first = index_at(top);
+        int last = first;
+        while (last < visible.length) {
+            int start = offsets[last] - (headers[last] != null ? header_height : 0);
+            if (start >= bottom) {
+                break;
+            }
+            last++;
+        }
+
+        /* Recycle rows that scrolled out of view */
+        var in_view = new HashTable<MenuSnapshotEntry,bool>(direct_hash, direct_equal);
+        for (int i = first; i < last; i++) {
+            in_view.insert(visible[i], true);
+        }
+        foreach (var entry in bound.get_keys()) {
+            if (in_view.contains(entry)) {
+                continue;
+            }
+            var row = bound.lookup(entry);
+            bound.remove(entry);
+            row.hide();
+            spare_rows.add(row);
+        }
+
+        int n_headers = 0;
+        for (int i = first; i < last; i++) {
+            var entry = visible[i];
+            var row = bound.lookup(entry);
+            if (row == null) {
+                row = acquire_row();
+                row.bind(entry);
+                bound.insert(entry, row);
+            }
+            place(row, offsets[i]);
+            if (i == selected) {
+                row.set_state_flags(Gtk.StateFlags.SELECTED, false);
+            } else {
+                row.unset_state_flags(Gtk.StateFlags.SELECTED);
+            }
+            if (!row.get_visible()) {
+                row.show_all();
+            }
+
+            if (headers[i] != null) {
+                var header = acquire_header(n_headers);
+                var markup = Markup.printf_escaped("<big>%s</big>", headers[i]);
+                if (header.get_label() != markup) {
+                    header.set_markup(markup);
+                }
+                place(header, offsets[i] - header_height);
+                header.show();
+                n_headers++;
+            }
+        }
+        for (int i = n_headers; i < header_pool.length; i++) {
+            header_pool[i].hide();
+        }
+    }
+
+    /**
+     * Move a child, unless it's already there. GtkLayout queues a resize on
+     * every move, even to the same spot.
+     */
+    void place(Gtk.Widget child, int y)
+    {
+        if (child.get_data<int>(MENU_LIST_Y_KEY) == y + 1) {
+            return;
+        }
+        child.set_data<int>(MENU_LIST_Y_KEY, y + 1);
+        move(child, 0, y);
+    }
+
+    public override void style_updated()
+    {
+        base.style_updated();
+        /* Theme or font change, measure again */
+        row_height = 0;
+        header_height = 0;
+        layout_entries();
+        update_visible();
+    }
+
+    public override void size_allocate(Gtk.Allocation alloc)
+    {
+        base.size_allocate(alloc);
+
+        /* Stretch the rows over the full width, rather than requesting it
+         * and queueing yet another resize. Binding happens elsewhere. */
+        int width = int.max(alloc.width, MENU_LIST_WIDTH);
+        foreach (var row in bound.get_values()) {
+            Gtk.Allocation child = { 0, row.get_data<int>(MENU_LIST_Y_KEY) - 1, width, row_height };
+            row.size_allocate(child);
+        }
+    }
+
+    /**
+     * The entry to launch for keyboard activation: the selection, or the
+     * first visible entry.
+     */
+    public MenuSnapshotEntry? get_selected_entry()
+    {
+        if (visible.length == 0) {
+            return null;
+        }
+        return visible[selected >= 0 ? selected : 0];
+    }
+
+    /**
+     * Move the selection up or down, keeping it in view
+     */
+    public void move_selection(int delta)
+    {
+        if (visible.length == 0) {
+            return;
+        }
+        selected = (selected + delta).clamp(0, visible.length - 1);
+        var adj = get_vadjustment();
+        if (adj != null) {
+            int top = offsets[selected] - (headers[selected] != null ? header_height : 0);
+            if (top < adj.value) {
+                adj.set_value(top);
+            } else if (offsets[selected] + row_height > adj.value + adj.page_size) {
+                adj.set_value(offsets[selected] + row_height - adj.page_size);
+            }
+        }
+        update_visible();
+    }
+
+    /**
+     * Reset the selection and scroll position, i.e. when shown again
+     */
+    public void reset_view()
+    {
+        selected = -1;
+        var adj = get_vadjustment();
+        if (adj != null) {
+            adj.set_value(0);
+        }
+        update_visible();
+    }
+}
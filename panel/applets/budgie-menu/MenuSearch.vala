@@ -0,0 +1,197 @@
+/*
+ * MenuSearch.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * How well an entry matched the search term, best first
+ */
+public enum MatchQuality
+{
+    NONE = -1,
+    FUZZY = 0,
+    DESCRIPTION,
+    OTHER_FIELD,
+    SUBSTRING,
+    WORD_PREFIX,
+    PREFIX,
+    EXACT
+}
+
+/**
+ * Prebuilt, normalized search strings for every entry of a MenuSnapshot.
+ *
+ * Built once per tree load (on the loader thread), after which each
+ * keystroke only compares pre-folded strings. When the query extends the
+ * previous one, only the previous matches are re-tested.
+ */
+public class MenuSearchIndex
+{
+    string[] display_names;
+    string[] names;
+    string[] executables;
+    string[] descriptions;
+
+    /* Match quality for each entry against last_query */
+    public MatchQuality[] ranks;
+
+    string last_query = "";
+    int[] last_matches = {};
+
+    public MenuSearchIndex(GenericArray<MenuSnapshotEntry> entries)
+    {
+        var n = entries.length;
+        display_names = new string[n];
+        names = new string[n];
+        executables = new string[n];
+        descriptions = new string[n];
+        ranks = new MatchQuality[n];
+
+        for (int i = 0; i < n; i++) {
+            var entry = entries[i];
+            display_names[i] = normalize(entry.display_name);
+            names[i] = normalize(entry.name);
+            executables[i] = normalize(entry.executable);
+            descriptions[i] = normalize(entry.description);
+            ranks[i] = MatchQuality.NONE;
+        }
+    }
+
+    /**
+     * Case-fold the string and strip any diacritics
+     */
+    public static string normalize(string? text)
+    {
+        if (text == null) {
+            return "";
+        }
+        var decomposed = text.normalize(-1, NormalizeMode.ALL);
+        if (decomposed == null) {
+            return text.casefold();
+        }
+        var sb = new StringBuilder.sized(decomposed.length);
+        int i = 0;
+        unichar c;
+        while (decomposed.get_next_char(ref i, out c)) {
+            var type = c.type();
+            if (type == UnicodeType.NON_SPACING_MARK || type == UnicodeType.ENCLOSING_MARK) {
+                continue;
+            }
+            sb.append_unichar(c);
+        }
+        return sb.str.casefold();
+    }
+
+    /**
+     * Update ranks for the (already normalized) query
+     *
+     * @return the number of matching entries
+     */
+    public int search(string query)
+    {
+        int[] matches = {};
+
+        if (query.length == 0) {
+            reset();
+            return 0;
+        }
+
+        if (last_query.length > 0 && query.has_prefix(last_query)) {
+            /* Narrowing: nothing outside the last results can match now */
+            foreach (var i in last_matches) {
+                ranks[i] = match(i, query);
+                if (ranks[i] != MatchQuality.NONE) {
+                    matches += i;
+                }
+            }
+        } else {
+            for (int i = 0; i < ranks.length; i++) {
+                ranks[i] = match(i, query);
+                if (ranks[i] != MatchQuality.NONE) {
+                    matches += i;
+                }
+            }
+        }
+
+        last_query = query;
+        last_matches = matches;
+        return matches.length;
+    }
+
+    /**
+     * Forget the current search
+     */
+    public void reset()
+    {
+        for (int i = 0; i < ranks.length; i++) {
+            ranks[i] = MatchQuality.NONE;
+        }
+        last_query = "";
+        last_matches = {};
+    }
+
+    MatchQuality match(int i, string query)
+    {
+        unowned string display = display_names[i];
+
+        if (display == query) {
+            return MatchQuality.EXACT;
+        }
+        if (display.has_prefix(query)) {
+            return MatchQuality.PREFIX;
+        }
+        int pos = display.index_of(query);
+        if (pos > 0) {
+            while (pos > 0) {
+                int p = pos;
+                unichar prev;
+                display.get_prev_char(ref p, out prev);
+                if (!prev.isalnum()) {
+                    return MatchQuality.WORD_PREFIX;
+                }
+                pos = display.index_of(query, pos + 1);
+            }
+            return MatchQuality.SUBSTRING;
+        }
+        if (query in names[i] || query in executables[i]) {
+            return MatchQuality.OTHER_FIELD;
+        }
+        if (query in descriptions[i]) {
+            return MatchQuality.DESCRIPTION;
+        }
+        if (is_subsequence(query, display)) {
+            return MatchQuality.FUZZY;
+        }
+        return MatchQuality.NONE;
+    }
+
+    /**
+     * Fuzzy match, i.e. "gmp" for "GNU Image Manipulation Program"
+     */
+    static bool is_subsequence(string needle, string haystack)
+    {
+        int n = 0;
+        int h = 0;
+        unichar nc;
+        unichar hc;
+
+        if (!needle.get_next_char(ref n, out nc)) {
+            return true;
+        }
+        while (haystack.get_next_char(ref h, out hc)) {
+            if (hc != nc) {
+                continue;
+            }
+            if (!needle.get_next_char(ref n, out nc)) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
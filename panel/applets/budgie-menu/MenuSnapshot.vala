@@ -0,0 +1,110 @@
+/*
+ * MenuSnapshot.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * Plain copy of a single menu entry, extracted off the main thread
+ */
+public class MenuSnapshotEntry
+{
+    public DesktopAppInfo info;
+    public GMenu.TreeDirectory directory;
+
+    public string display_name;
+    public string? description;
+    public string? name;
+    public string? executable;
+
+    /* Index within the snapshot (and its MenuSearchIndex) */
+    public int position;
+    /* Decayed usage score, for sorting */
+    public double score = 0.0;
+
+    public MenuSnapshotEntry(DesktopAppInfo info, GMenu.TreeDirectory directory, int position)
+    {
+        this.info = info;
+        this.position = position;
+        this.directory = directory;
+        display_name = info.get_display_name();
+        if (display_name == null) {
+            display_name = "";
+        }
+        description = info.get_description();
+        name = info.get_name();
+        executable = info.get_executable();
+    }
+}
+
+/**
+ * Fully loaded GMenu.Tree, flattened into categories and entries so that
+ * the main thread never has to walk (or load) the tree itself.
+ */
+public class MenuSnapshot
+{
+    public GMenu.Tree tree;
+    public GenericArray<GMenu.TreeDirectory> categories;
+    public GenericArray<MenuSnapshotEntry> entries;
+    public MenuSearchIndex index;
+
+    MenuSnapshot(GMenu.Tree tree)
+    {
+        this.tree = tree;
+        categories = new GenericArray<GMenu.TreeDirectory>();
+        entries = new GenericArray<MenuSnapshotEntry>();
+    }
+
+    /**
+     * Load and flatten the menu tree. This blocks, so only call it from a
+     * worker thread.
+     *
+     * @return a new snapshot, or null if the tree couldn't be loaded
+     */
+    public static MenuSnapshot? build()
+    {
+        var tree = new GMenu.Tree(APPS_ID, GMenu.TreeFlags.SORT_DISPLAY_NAME);
+        try {
+            tree.load_sync();
+        } catch (Error e) {
+            stderr.printf("Error: %s\n", e.message);
+            return null;
+        }
+        var snapshot = new MenuSnapshot(tree);
+        snapshot.walk(tree.get_root_directory(), null);
+        snapshot.index = new MenuSearchIndex(snapshot.entries);
+        return snapshot;
+    }
+
+    /**
+     * Collect "menus" (.desktop's) recursively
+     *
+     * @param root Directory to walk
+     * @param parent The category root belongs to, or null for the top level
+     */
+    void walk(GMenu.TreeDirectory root, GMenu.TreeDirectory? parent)
+    {
+        var it = root.iter();
+        GMenu.TreeItemType? type;
+
+        while ((type = it.next()) != GMenu.TreeItemType.INVALID) {
+            if (type == GMenu.TreeItemType.DIRECTORY) {
+                var dir = it.get_directory();
+                categories.add(dir);
+                walk(dir, dir);
+            } else if (type == GMenu.TreeItemType.ENTRY) {
+                var appinfo = it.get_entry().get_app_info();
+                if (parent == null) {
+                    warning("%s has no parent directory, not adding to menu\n", appinfo.get_display_name());
+                    continue;
+                }
+                entries.add(new MenuSnapshotEntry(appinfo, parent, entries.length));
+            }
+        }
+    }
+}
@@ -0,0 +1,371 @@
+/*
+ * DesktopIndex.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/**
+ * Bump whenever the on-disk layout changes, forcing a rebuild
+ */
+const int DESKTOP_INDEX_VERSION = 2;
+
+/**
+ * How long to wait after the last change before writing the cache out
+ */
+const uint DESKTOP_INDEX_SAVE_DELAY = 2;
+
+/**
+ * Maps window class hints to .desktop IDs without parsing .desktop files
+ * on every lookup.
+ *
+ * The index lives in memory and is mirrored to $XDG_CACHE_HOME, keyed by
+ * the modification times of the applications directories and the .desktop
+ * files within them. A stale cache is rebuilt once from AppInfo.get_all();
+ * after that, changes inside the directories are applied one .desktop file
+ * at a time.
+ */
+public class DesktopIndex : Object
+{
+
+    /* desktop ID -> StartupWMClass, or "" when the entry has none */
+    Gee.HashMap<string,string> ids;
+    /* StartupWMClass -> desktop ID */
+    Gee.HashMap<string,string> wmclasses;
+
+    /* applications directories, highest precedence first */
+    string[] app_dirs;
+    /* directory path -> its monitor, subdirectories included */
+    Gee.HashMap<string,FileMonitor> monitors;
+    string cache_file;
+    uint save_id = 0;
+
+    /**
+     * Emitted when the index changes
+     *
+     * @param desktop_id The changed ID, or null if the whole index was rebuilt
+     */
+    public signal void changed(string? desktop_id);
+
+    public DesktopIndex()
+    {
+        ids = new Gee.HashMap<string,string>(null,null,null);
+        wmclasses = new Gee.HashMap<string,string>(null,null,null);
+        monitors = new Gee.HashMap<string,FileMonitor>(null,null,null);
+
+        app_dirs += Path.build_filename(Environment.get_user_data_dir(), "applications");
+        foreach (var dir in Environment.get_system_data_dirs()) {
+            app_dirs += Path.build_filename(dir, "applications");
+        }
+        cache_file = Path.build_filename(Environment.get_user_cache_dir(), "budgie-desktop", "desktop-index");
+
+        if (!load_cache()) {
+            rebuild();
+            save_cache();
+        }
+
+        foreach (var dir in app_dirs) {
+            watch_dir(dir);
+        }
+    }
+
+    /**
+     * Monitor a directory and everything below it
+     */
+    void watch_dir(string dir)
+    {
+        if (monitors.has_key(dir)) {
+            return;
+        }
+        var file = File.new_for_path(dir);
+        try {
+            var monitor = file.monitor_directory(FileMonitorFlags.NONE, null);
+            monitor.changed.connect(on_dir_changed);
+            monitors[dir] = monitor;
+
+            var children = file.enumerate_children(
+                FileAttribute.STANDARD_NAME + "," + FileAttribute.STANDARD_TYPE,
+                FileQueryInfoFlags.NONE, null);
+            FileInfo? info;
+            while ((info = children.next_file(null)) != null) {
+                if (info.get_file_type() == FileType.DIRECTORY) {
+                    watch_dir(Path.build_filename(dir, info.get_name()));
+                }
+            }
+        } catch (Error e) {
+            /* Non-existent directories are perfectly normal */
+        }
+    }
+
+    /**
+     * Stop monitoring a removed directory and everything that was below it
+     */
+    void unwatch_dir(string dir)
+    {
+        var prefix = dir + "/";
+        foreach (var path in monitors.keys.to_array()) {
+            if (path == dir || path.has_prefix(prefix)) {
+                monitors[path].cancel();
+                monitors.unset(path);
+            }
+        }
+    }
+
+    /**
+     * Determine whether the given desktop ID is known
+     */
+    public bool has_id(string desktop_id)
+    {
+        return ids.has_key(desktop_id);
+    }
+
+    /**
+     * Look up the desktop ID declaring the given StartupWMClass
+     *
+     * @return a desktop ID if found, otherwise null
+     */
+    public string? lookup_wmclass(string wmclass)
+    {
+        return wmclasses[wmclass];
+    }
+
+    void add_entry(string desktop_id, string? wmclass)
+    {
+        ids[desktop_id] = wmclass != null ? wmclass : "";
+        if (wmclass != null && wmclass != "") {
+            wmclasses[wmclass] = desktop_id;
+        }
+    }
+
+    void remove_entry(string desktop_id)
+    {
+        if (!ids.has_key(desktop_id)) {
+            return;
+        }
+        var wmclass = ids[desktop_id];
+        if (wmclass != "" && wmclasses[wmclass] == desktop_id) {
+            wmclasses.unset(wmclass);
+        }
+        ids.unset(desktop_id);
+    }
+
+    /**
+     * Full (slow) rebuild of the index from GIO
+     */
+    void rebuild()
+    {
+        ids.clear();
+        wmclasses.clear();
+        foreach (var appinfo in AppInfo.get_all()) {
+            var dinfo = appinfo as DesktopAppInfo;
+            if (dinfo == null || dinfo.get_id() == null) {
+                continue;
+            }
+            add_entry(dinfo.get_id(), dinfo.get_startup_wm_class());
+        }
+    }
+
+    /**
+     * Desktop ID of a file below one of the applications directories, i.e.
+     * applications/kde4/foo.desktop is kde4-foo.desktop
+     */
+    string? desktop_id_for(File file)
+    {
+        foreach (var dir in app_dirs) {
+            var rel = File.new_for_path(dir).get_relative_path(file);
+            if (rel != null) {
+                return rel.replace("/", "-");
+            }
+        }
+        return null;
+    }
+
+    /**
+     * Find the file for a desktop ID within one applications directory,
+     * trying each dash as a subdirectory separator in turn
+     */
+    string? find_desktop_file(string dir, string desktop_id)
+    {
+        var path = Path.build_filename(dir, desktop_id);
+        if (FileUtils.test(path, FileTest.IS_REGULAR)) {
+            return path;
+        }
+        int index = 0;
+        while ((index = desktop_id.index_of_char('-', index)) > 0) {
+            var subdir = Path.build_filename(dir, desktop_id.substring(0, index));
+            if (FileUtils.test(subdir, FileTest.IS_DIR)) {
+                var found = find_desktop_file(subdir, desktop_id.substring(index + 1));
+                if (found != null) {
+                    return found;
+                }
+            }
+            index++;
+        }
+        return null;
+    }
+
+    /**
+     * Re-read a single .desktop file, honouring directory precedence
+     */
+    void update_entry(string desktop_id)
+    {
+        remove_entry(desktop_id);
+        foreach (var dir in app_dirs) {
+            var path = find_desktop_file(dir, desktop_id);
+            if (path == null) {
+                continue;
+            }
+            var dinfo = new DesktopAppInfo.from_filename(path);
+            if (dinfo != null && !dinfo.get_is_hidden()) {
+                add_entry(desktop_id, dinfo.get_startup_wm_class());
+            }
+            /* First match masks the rest, even if it's hidden or broken */
+            break;
+        }
+    }
+
+    void on_dir_changed(File file, File? other, FileMonitorEvent event)
+    {
+        var path = file.get_path();
+
+        if (!path.has_suffix(".desktop")) {
+            /* Subdirectories coming and going are rare, just start again. */
+            if (event == FileMonitorEvent.CREATED &&
+                FileUtils.test(path, FileTest.IS_DIR)) {
+                watch_dir(path);
+            } else if (event == FileMonitorEvent.DELETED && monitors.has_key(path)) {
+                unwatch_dir(path);
+            } else {
+                return;
+            }
+            rebuild();
+            changed(null);
+            queue_save();
+            return;
+        }
+
+        var desktop_id = desktop_id_for(file);
+        if (desktop_id == null) {
+            return;
+        }
+
+        switch (event) {
+            case FileMonitorEvent.CREATED:
+            case FileMonitorEvent.DELETED:
+            case FileMonitorEvent.CHANGES_DONE_HINT:
+                update_entry(desktop_id);
+                changed(desktop_id);
+                queue_save();
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Stamp of the applications directories and every .desktop file within
+     * them, used to validate the on-disk cache. Files rewritten in place
+     * while we weren't running (i.e. package upgrades) change it too.
+     */
+    string compute_stamp()
+    {
+        var checksum = new Checksum(ChecksumType.SHA1);
+
+        foreach (var dir in app_dirs) {
+            append_stamp(checksum, File.new_for_path(dir));
+        }
+        return checksum.get_string();
+    }
+
+    void append_stamp(Checksum checksum, File dir)
+    {
+        uint64 mtime = 0;
+        try {
+            var info = dir.query_info(FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE, null);
+            mtime = info.get_attribute_uint64(FileAttribute.TIME_MODIFIED);
+        } catch (Error e) {
+            /* Missing directory, stamp as 0 so its creation is noticed */
+        }
+        var line = "%s:%s;".printf(dir.get_path(), mtime.to_string());
+        checksum.update(line.data, line.length);
+
+        try {
+            var children = dir.enumerate_children(
+                FileAttribute.STANDARD_NAME + "," + FileAttribute.STANDARD_TYPE + "," +
+                FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE, null);
+            FileInfo? info;
+            while ((info = children.next_file(null)) != null) {
+                var name = info.get_name();
+                if (info.get_file_type() == FileType.DIRECTORY) {
+                    append_stamp(checksum, dir.get_child(name));
+                } else if (name.has_suffix(".desktop")) {
+                    line = "%s:%s;".printf(name,
+                        info.get_attribute_uint64(FileAttribute.TIME_MODIFIED).to_string());
+                    checksum.update(line.data, line.length);
+                }
+            }
+        } catch (Error e) {
+            return;
+        }
+    }
+
+    bool load_cache()
+    {
+        var kf = new KeyFile();
+        try {
+            kf.load_from_file(cache_file, KeyFileFlags.NONE);
+            if (kf.get_integer("Index", "Version") != DESKTOP_INDEX_VERSION) {
+                return false;
+            }
+            if (kf.get_string("Index", "Stamp") != compute_stamp()) {
+                return false;
+            }
+            if (!kf.has_group("Ids")) {
+                return true;
+            }
+            foreach (var key in kf.get_keys("Ids")) {
+                add_entry(key, kf.get_string("Ids", key));
+            }
+        } catch (Error e) {
+            ids.clear();
+            wmclasses.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void save_cache()
+    {
+        var kf = new KeyFile();
+        kf.set_integer("Index", "Version", DESKTOP_INDEX_VERSION);
+        kf.set_string("Index", "Stamp", compute_stamp());
+        foreach (var entry in ids.entries) {
+            kf.set_string("Ids", entry.key, entry.value);
+        }
+        try {
+            DirUtils.create_with_parents(Path.get_dirname(cache_file), 00755);
+            FileUtils.set_contents(cache_file, kf.to_data());
+        } catch (Error e) {
+            warning("Unable to save desktop index: %s", e.message);
+        }
+    }
+
+    /**
+     * Bursts of changes (i.e. package installs) only write the cache once
+     */
+    void queue_save()
+    {
+        if (save_id > 0) {
+            Source.remove(save_id);
+        }
+        save_id = Timeout.add_seconds(DESKTOP_INDEX_SAVE_DELAY, ()=> {
+            save_id = 0;
+            save_cache();
+            return false;
+        });
+    }
+}
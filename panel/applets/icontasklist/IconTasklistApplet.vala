@@ -59,7 +59,12 @@ public class DesktopHelper : Object
 {
 
     Gee.HashMap<string?,string?> simpletons;
-    Gee.HashMap<string?,string?> startupids;
+    DesktopIndex index;
+
+    /* Resolved (class group, instance) pairs -> desktop ID, "" if unknown */
+    Gee.HashMap<string,string> window_ids;
+    /* Parsed DesktopAppInfo's, shared by every window of an application */
+    Gee.HashMap<string,DesktopAppInfo> app_infos;
 
     public DesktopHelper()
     {
@@ -70,25 +75,78 @@ public class DesktopHelper : Object
         simpletons["gnome-screenshot"] = "org.gnome.Screenshot";
         simpletons["nautilus"] = "org.gnome.Nautilus";
 
-#if HAVE_GLIB240
-        var monitor = AppInfoMonitor.get();
-        monitor.changed.connect(()=> {
-            startupids = null;
-            reload_ids();
+        window_ids = new Gee.HashMap<string,string>(null,null,null);
+        app_infos = new Gee.HashMap<string,DesktopAppInfo>(null,null,null);
+
+        index = new DesktopIndex();
+        index.changed.connect((id)=> {
+            /* Any change can alter a resolution, but only drop the one parsed app */
+            window_ids.clear();
+            if (id == null) {
+                app_infos.clear();
+            } else {
+                app_infos.unset(id);
+            }
         });
-#endif
-        reload_ids();
     }
 
-    void reload_ids()
+    /**
+     * Resolve the desktop ID for a window's class hints using the index
+     *
+     * @return a desktop ID if found, otherwise null
+     */
+    string? resolve_id(string class_group, string? class_instance)
     {
-        startupids = new Gee.HashMap<string?,string?>(null,null,null);
-        foreach (var appinfo in AppInfo.get_all()) {
-            var dinfo = appinfo as DesktopAppInfo;
-            if (dinfo.get_startup_wm_class() != null) {
-                startupids[dinfo.get_startup_wm_class()] = dinfo.get_id();
+        string? id = null;
+
+        /* StartupWMClass is authoritative, check instance then group */
+        if (class_instance != null) {
+            id = index.lookup_wmclass(class_instance);
+        }
+        if (id == null) {
+            id = index.lookup_wmclass(class_group);
+        }
+        if (id != null) {
+            return id;
+        }
+
+        var c = class_group[0].tolower();
+        var app_name_clean = "%c%s".printf(c,class_group[1:class_group.length]);
+        id = "%s.desktop".printf(app_name_clean);
+        if (index.has_id(id)) {
+            return id;
+        }
+        if (app_name_clean in simpletons) {
+            id = "%s.desktop".printf(simpletons[app_name_clean]);
+            if (index.has_id(id)) {
+                return id;
+            }
+        }
+        if (class_instance != null) {
+            id = "%s.desktop".printf(class_instance);
+            if (index.has_id(id)) {
+                return id;
             }
         }
+        return null;
+    }
+
+    /**
+     * Obtain a (shared) DesktopAppInfo for the given desktop ID
+     *
+     * @return a DesktopAppInfo if found, otherwise null.
+     */
+    public DesktopAppInfo? get_app_info(string desktop_id)
+    {
+        var info = app_infos[desktop_id];
+        if (info != null) {
+            return info;
+        }
+        info = new DesktopAppInfo(desktop_id);
+        if (info != null) {
+            app_infos[desktop_id] = info;
+        }
+        return info;
     }
 
     /**
@@ -96,44 +154,42 @@ public class DesktopHelper : Object
      * @param window X11 window to obtain DesktopAppInfo for
      *
      * @return a DesktopAppInfo if found, otherwise null.
-     * 
-     * @note This is immensely inefficient. We still need to cache some
-     * lookups.
+     *
+     * @note Lookups are memoized per class hint pair, so only the first
+     * window of any given application ever touches the index.
      */
     public DesktopAppInfo? get_app_info_for_window(Wnck.Window? window)
     {
         if (window == null) {
             return null;
         }
-        if (window.get_class_group_name() == null) {
+        var class_group = window.get_class_group_name();
+        if (class_group == null || class_group.length == 0) {
             return null;
         }
-        var app_name = window.get_class_group_name();
-        string? app_name_clean;
-        // track suffix in case we use startup wm class to find id
-        string suffix = ".desktop";
+        var class_instance = window.get_class_instance_name();
+        var key = "%s\n%s".printf(class_group, class_instance != null ? class_instance : "");
 
-        if (window.get_class_instance_name() in startupids) {
-            app_name = startupids[window.get_class_instance_name()];
-            app_name_clean = app_name;
-            suffix = "";
-        } else {
-            var c = app_name[0].tolower();
-            app_name_clean = "%c%s".printf(c,app_name[1:app_name.length]);
+        string? id = window_ids[key];
+        if (id == null) {
+            id = resolve_id(class_group, class_instance);
+            window_ids[key] = id != null ? id : "";
         }
-
-        var p1 = new DesktopAppInfo("%s%s".printf(app_name_clean, suffix));
-        if (p1 == null) {
-            if (app_name_clean in simpletons) {
-                p1 = new DesktopAppInfo("%s%s".printf(simpletons[app_name_clean], suffix));
-            }
+        if (id == null || id == "") {
+            return null;
         }
-        return p1;
+        return get_app_info(id);
     }
 
+    /* Shared by every set_pinned call, rather than one per click */
+    static Settings? pin_settings = null;
+
     public static void set_pinned(DesktopAppInfo app_info, bool pinned)
     {
-        Settings settings = new Settings("com.evolve-os.budgie.panel");
+        if (pin_settings == null) {
+            pin_settings = new Settings("com.evolve-os.budgie.panel");
+        }
+        unowned Settings settings = pin_settings;
         string[] launchers = settings.get_strv("pinned-launchers");
         if (pinned) {
             if (app_info.get_id() in launchers) {
@@ -165,7 +221,10 @@ public class IconButton : Gtk.ToggleButton
 
     public new Gtk.Image image;
     public unowned Wnck.Window? window;
-    protected Wnck.ActionMenu menu;
+    protected Wnck.ActionMenu? menu = null;
+    /* What the cached menu was built for */
+    private unowned Wnck.Window? menu_window = null;
+    private GLib.DesktopAppInfo? menu_ainfo = null;
     public int icon_size;
     public GLib.DesktopAppInfo? ainfo;
     private Gtk.MenuItem pinnage;
@@ -182,6 +241,12 @@ public class IconButton : Gtk.ToggleButton
 
     protected int current_cycles = 0;
 
+    /**
+     * Actions menus constructed so far, for comparison against the number
+     * of buttons (G_MESSAGES_DEBUG=all shows it along with build times)
+     */
+    static uint n_menus_built = 0;
+
     public void update_from_window()
     {
         we_urgent = false;
@@ -216,8 +281,43 @@ public class IconButton : Gtk.ToggleButton
             p.set_opacity(ACTIVE_OPACITY);
         }
 
+        /* The actions menu is built on first right click, and only thrown
+         * away if it no longer matches our window or application. */
+        if (menu != null && (menu_window != window || menu_ainfo != ainfo)) {
+            invalidate_menu();
+        }
+        queue_draw();
+    }
+
+    /**
+     * Drop the cached actions menu, it'll be rebuilt on demand
+     */
+    protected void invalidate_menu()
+    {
+        if (menu == null) {
+            return;
+        }
+        menu.destroy();
+        menu = null;
+        menu_window = null;
+        menu_ainfo = null;
+    }
+
+    /**
+     * Construct the actions menu for our current window, if we haven't
+     * already got a valid one.
+     */
+    protected void ensure_menu()
+    {
+        if (menu != null) {
+            return;
+        }
+        int64 start = get_monotonic_time();
+
         // Actions menu
         menu = new Wnck.ActionMenu(window);
+        menu_window = window;
+        menu_ainfo = ainfo;
 
         var sep = new Gtk.SeparatorMenuItem();
         menu.append(sep);
@@ -244,12 +344,11 @@ public class IconButton : Gtk.ToggleButton
         if (ainfo != null) {
             // Desktop app actions =)
             unowned string[] actions = ainfo.list_actions();
-            if (actions.length == 0) {
-                return;
+            if (actions.length > 0) {
+                sep = new Gtk.SeparatorMenuItem();
+                menu.append(sep);
+                sep.show_all();
             }
-            sep = new Gtk.SeparatorMenuItem();
-            menu.append(sep);
-            sep.show_all();
             foreach (var action in actions) {
                 var display_name = ainfo.get_action_name(action);
                 var item = new Gtk.MenuItem.with_label(display_name);
@@ -272,7 +371,10 @@ public class IconButton : Gtk.ToggleButton
                 menu.append(item);
             }
         }
-        queue_draw();
+
+        n_menus_built++;
+        debug("Built actions menu #%u for %s in %sus", n_menus_built,
+            window.get_name(), (get_monotonic_time() - start).to_string());
     }
 
     protected void on_state_changed(Wnck.WindowState changed, Wnck.WindowState state)
@@ -400,15 +502,13 @@ public class IconButton : Gtk.ToggleButton
             return;
         }
 
-        if (window.get_icon_is_fallback()) {
-            if (ainfo != null && ainfo.get_icon() != null) {
-                image.set_from_gicon(ainfo.get_icon(), Gtk.IconSize.INVALID);
-            } else {
-                image.set_from_pixbuf(window.get_icon());
-            }
-        } else {
-            image.set_from_pixbuf(window.get_icon());
+        if (window.get_icon_is_fallback() && ainfo != null && ainfo.get_icon() != null) {
+            Budgie.IconCache.set_image_from_gicon(image, ainfo.get_icon(), icon_size);
+            return;
         }
+        var scale = image.get_scale_factor();
+        var pixbuf = Budgie.IconCache.get_default().load_pixbuf(window.get_icon(), icon_size, scale);
+        Budgie.IconCache.set_image_from_pixbuf(image, pixbuf, scale);
         image.pixel_size = icon_size;
     }
 
@@ -419,24 +519,24 @@ public class IconButton : Gtk.ToggleButton
     {
         var timestamp = Gtk.get_current_event_time();
 
-        if (this is /*Sparta*/ PinnedIconButton) {
-            unpinnage.show();
-            pinnage.hide();
-        } else {
-            unpinnage.hide();
-            pinnage.show();
-        }
-
-        if (ainfo == null) {
-            unpinnage.hide();
-            pinnage.hide();
-            sep_item.hide();
-        } else {
-            sep_item.show();
-        }
-
         // Right click, i.e. actions menu
         if (event.button == 3) {
+            ensure_menu();
+            if (this is /*Sparta*/ PinnedIconButton) {
+                unpinnage.show();
+                pinnage.hide();
+            } else {
+                unpinnage.hide();
+                pinnage.show();
+            }
+
+            if (ainfo == null) {
+                unpinnage.hide();
+                pinnage.hide();
+                sep_item.hide();
+            } else {
+                sep_item.show();
+            }
             menu.popup(null, null, null, event.button, timestamp);
             return true;
         }
@@ -472,7 +572,7 @@ public class PinnedIconButton : IconButton
 
         this.context = context;
         set_tooltip_text("Launch %s".printf(info.get_display_name()));
-        image.set_from_gicon(info.get_icon(), Gtk.IconSize.INVALID);
+        Budgie.IconCache.set_image_from_gicon(image, info.get_icon(), size);
 
         set_opacity(INACTIVE_OPACITY);
 
@@ -521,17 +621,16 @@ public class PinnedIconButton : IconButton
             base.update_icon();
             return;
         }
-        image.pixel_size = icon_size;
+        Budgie.IconCache.set_image_from_gicon(image, app_info.get_icon(), icon_size);
     }
 
     public void reset()
     {
-        image.set_from_gicon(app_info.get_icon(), Gtk.IconSize.INVALID);
+        Budgie.IconCache.set_image_from_gicon(image, app_info.get_icon(), icon_size);
         set_tooltip_text("Launch %s".printf(app_info.get_display_name()));
         set_active(false);
         // Actions menu
-        menu.destroy();
-        menu = null;
+        invalidate_menu();
         window = null;
         id = null;
         set_opacity(INACTIVE_OPACITY);
@@ -556,13 +655,132 @@ public class IconTasklistAppletImpl : Budgie.Applet
     protected Wnck.Screen screen;
     protected Gee.HashMap<Wnck.Window,IconButton> buttons;
     protected Gee.HashMap<string?,PinnedIconButton?> pin_buttons;
+    /* Desktop IDs in the same order as the children of pinned */
+    protected Gee.ArrayList<string> pin_order;
+    /* Window buttons keyed by desktop ID, for O(1) pin promotion */
+    protected Gee.HashMultiMap<string,IconButton> app_buttons;
     protected int icon_size = 32;
     private Settings settings;
 
     protected Gdk.AppLaunchContext context;
     protected DesktopHelper helper;
 
+    /* Wnck events waiting for the next reconcile pass */
+    protected Gee.ArrayList<Wnck.Window> pending_opened;
+    protected Gee.HashSet<Wnck.Window> pending_closed;
+    protected Gee.HashSet<Wnck.Window> pending_inactive;
+    protected bool pending_active = false;
+    private uint reconcile_id = 0;
+    private bool reconcile_on_tick = false;
+
+    /**
+     * Number of Wnck window events received
+     */
+    public uint64 events_received { public get; private set; default = 0; }
+
+    /**
+     * Number of reconcile passes actually executed for those events
+     */
+    public uint64 passes_executed { public get; private set; default = 0; }
+
     protected void window_opened(Wnck.Window window)
+    {
+        events_received++;
+        pending_opened.add(window);
+        queue_reconcile();
+    }
+
+    protected void window_closed(Wnck.Window window)
+    {
+        events_received++;
+        /* Opened and closed within one burst, nothing to do at all */
+        if (pending_opened.remove(window)) {
+            return;
+        }
+        pending_closed.add(window);
+        queue_reconcile();
+    }
+
+    protected void active_window_changed(Wnck.Window? previous_window)
+    {
+        events_received++;
+        if (previous_window != null) {
+            pending_inactive.add(previous_window);
+        }
+        pending_active = true;
+        queue_reconcile();
+    }
+
+    /**
+     * Schedule a reconcile pass for the next frame. Further events
+     * arriving before then are folded into the same pass.
+     */
+    protected void queue_reconcile()
+    {
+        if (reconcile_id > 0) {
+            return;
+        }
+        /* The frame clock only ticks while we're mapped */
+        if (get_mapped()) {
+            reconcile_on_tick = true;
+            reconcile_id = add_tick_callback(()=> {
+                reconcile();
+                return false;
+            });
+        } else {
+            reconcile_on_tick = false;
+            reconcile_id = Idle.add(()=> {
+                reconcile();
+                return false;
+            });
+        }
+    }
+
+    /**
+     * Apply every queued window event in a single pass, so that a burst
+     * of windows only causes one relayout.
+     */
+    protected void reconcile()
+    {
+        reconcile_id = 0;
+        passes_executed++;
+
+        foreach (var window in pending_closed) {
+            remove_window(window);
+            pending_inactive.remove(window);
+        }
+        pending_closed.clear();
+
+        foreach (var window in pending_opened) {
+            add_window(window);
+        }
+        pending_opened.clear();
+
+        if (pending_active) {
+            update_active();
+        }
+    }
+
+    /**
+     * Drop any queued work, i.e. when we're going away
+     */
+    protected void cancel_reconcile()
+    {
+        if (reconcile_id > 0) {
+            if (reconcile_on_tick) {
+                remove_tick_callback(reconcile_id);
+            } else {
+                Source.remove(reconcile_id);
+            }
+            reconcile_id = 0;
+        }
+        pending_opened.clear();
+        pending_closed.clear();
+        pending_inactive.clear();
+        pending_active = false;
+    }
+
+    protected void add_window(Wnck.Window window)
     {
         // doesn't go on our list
         if (window.is_skip_tasklist()) {
@@ -607,11 +825,11 @@ public class IconTasklistAppletImpl : Budgie.Applet
             button = btn;
             widget.pack_start(btn, false, false, 0);
         }
-        buttons[window] = button;
+        track_button(window, button);
         button.show_all();
     }
 
-    protected void window_closed(Wnck.Window window)
+    protected void remove_window(Wnck.Window window)
     {
         IconButton? btn = null;
         if (!buttons.has_key(window)) {
@@ -625,24 +843,51 @@ public class IconTasklistAppletImpl : Budgie.Applet
         } else {
             btn.destroy();
         }
+        untrack_button(window);
+    }
+
+    /**
+     * Associate a button with a window, indexing it by its desktop ID
+     */
+    protected void track_button(Wnck.Window window, IconButton button)
+    {
+        untrack_button(window);
+        buttons[window] = button;
+        if (button.ainfo != null) {
+            app_buttons[button.ainfo.get_id()] = button;
+        }
+    }
+
+    protected void untrack_button(Wnck.Window window)
+    {
+        var button = buttons[window];
+        if (button == null) {
+            return;
+        }
+        if (button.ainfo != null) {
+            app_buttons.remove(button.ainfo.get_id(), button);
+        }
         buttons.unset(window);
     }
 
     /**
      * Just update the active state on the buttons
      */
-    protected void active_window_changed(Wnck.Window? previous_window)
+    protected void update_active()
     {
         IconButton? btn;
         Wnck.Window? new_active;
-        if (previous_window != null)
-        {
-            // Update old active button
+
+        // Update old active buttons, however many changes we batched
+        foreach (var previous_window in pending_inactive) {
             if (buttons.has_key(previous_window)) {
                 btn = buttons[previous_window];
                 btn.set_active(false);
-            } 
+            }
         }
+        pending_inactive.clear();
+        pending_active = false;
+
         new_active = screen.get_active_window();
         if (new_active == null) {
             return;
@@ -663,6 +908,13 @@ public class IconTasklistAppletImpl : Budgie.Applet
         // Easy mapping :)
         buttons = new Gee.HashMap<Wnck.Window,IconButton>(null,null,null);
         pin_buttons = new Gee.HashMap<string?,PinnedIconButton?>(null,null,null);
+        pin_order = new Gee.ArrayList<string>();
+        app_buttons = new Gee.HashMultiMap<string,IconButton>();
+
+        pending_opened = new Gee.ArrayList<Wnck.Window>();
+        pending_closed = new Gee.HashSet<Wnck.Window>();
+        pending_inactive = new Gee.HashSet<Wnck.Window>();
+        destroy.connect(cancel_reconcile);
 
         main_layout = new Gtk.Box(Gtk.Orientation.HORIZONTAL, 0);
         pinned = new Gtk.Box(Gtk.Orientation.HORIZONTAL, 0);
@@ -731,69 +983,119 @@ public class IconTasklistAppletImpl : Budgie.Applet
         if (key != "pinned-launchers") {
             return;
         }
-        string[] files = settings.get_strv(key);
-        /* We don't actually remove anything >_> */
-        foreach (string desktopfile in settings.get_strv(key)) {
-            /* Ensure we don't have this fella already. */
-            if (pin_buttons.has_key(desktopfile)) {
-                continue;
+        reconcile_pins(settings.get_strv(key));
+    }
+
+    /**
+     * Diff the desired launchers against the current ones, and only touch
+     * the PinnedIconButtons which were added, removed or moved.
+     */
+    protected void reconcile_pins(string[] files)
+    {
+        var wanted = new Gee.HashSet<string>();
+        foreach (var desktopfile in files) {
+            wanted.add(desktopfile);
+        }
+
+        /* Removals first, so pin_order only holds survivors */
+        string[] removals = {};
+        foreach (var key_name in pin_order) {
+            if (!wanted.contains(key_name)) {
+                removals += key_name;
             }
-            var info = new DesktopAppInfo(desktopfile);
-            if (info == null) {
-                message("Invalid application! %s", desktopfile);
+        }
+        foreach (var key_name in removals) {
+            unpin_launcher(key_name);
+        }
+
+        /* Additions are appended, and placed by the reorder pass */
+        var new_order = new Gee.ArrayList<string>();
+        var placed = new Gee.HashSet<string>();
+        foreach (var desktopfile in files) {
+            if (placed.contains(desktopfile)) {
                 continue;
             }
-            var button = new PinnedIconButton(info, icon_size, ref this.context);
-            pin_buttons[desktopfile] = button;
-            pinned.pack_start(button, false, false, 0);
-
-            // Do we already have an icon button for this?
-            foreach (var keyn in buttons.keys) {
-                var btn = buttons[keyn];
-                if (btn.ainfo == null) {
-                    continue;
-                }
-                if (btn.ainfo.get_id() == info.get_id() && btn.requested_pin) {
-                    // Pinning an already active button.
-                    button.window = btn.window;
-                    // destroy old one
-                    btn.destroy();
-                    buttons.unset(keyn);
-                    buttons[keyn] = button;
-                    button.update_from_window();
-                    break;
-                }
+            if (!pin_buttons.has_key(desktopfile) && !pin_launcher(desktopfile)) {
+                continue;
             }
-
-            button.show_all();
+            placed.add(desktopfile);
+            new_order.add(desktopfile);
         }
-        string[] removals = {};
-        /* Conversely, remove ones which have been unset. */
-        foreach (string key_name in pin_buttons.keys) {
-            if (key_name in files) {
+
+        /* Only move the children which are out of place */
+        for (int i = 0; i < new_order.size; i++) {
+            var key_name = new_order[i];
+            if (pin_order[i] == key_name) {
                 continue;
             }
-            /* We have a removal. */
-            PinnedIconButton? btn = pin_buttons[key_name];
-            if (btn.window == null) {
-                btn.destroy();
-            } else {
-                /* We need to move this fella.. */
-                IconButton b2 = new IconButton(btn.window, icon_size, (owned)btn.app_info);
-                btn.destroy();
-                widget.pack_start(b2, false, false, 0);
-                buttons[b2.window]  = b2;
-                b2.show_all();
+            pinned.reorder_child(pin_buttons[key_name], i);
+            pin_order.remove(key_name);
+            pin_order.insert(i, key_name);
+        }
+    }
+
+    /**
+     * Add a new PinnedIconButton, adopting the window of a button which
+     * asked to be pinned.
+     *
+     * @return true if the launcher is valid and was added
+     */
+    protected bool pin_launcher(string desktopfile)
+    {
+        var info = helper.get_app_info(desktopfile);
+        if (info == null) {
+            message("Invalid application! %s", desktopfile);
+            return false;
+        }
+        var button = new PinnedIconButton(info, icon_size, ref this.context);
+        pin_buttons[desktopfile] = button;
+        pin_order.add(desktopfile);
+        pinned.pack_start(button, false, false, 0);
+
+        // Do we already have an icon button for this?
+        IconButton? requester = null;
+        foreach (var btn in app_buttons[info.get_id()]) {
+            if (!(btn is PinnedIconButton) && btn.requested_pin) {
+                requester = btn;
+                break;
             }
-            removals += key_name;
         }
-        foreach (string key_name in removals) {
-            pin_buttons.unset(key_name);
+        if (requester != null) {
+            // Pinning an already active button.
+            unowned Wnck.Window window = requester.window;
+            button.window = window;
+            // destroy old one
+            untrack_button(window);
+            requester.destroy();
+            track_button(window, button);
+            button.update_from_window();
         }
 
-        for (int i=0; i<files.length; i++) {
-            pinned.reorder_child(pin_buttons[files[i]], i);
+        button.show_all();
+        return true;
+    }
+
+    /**
+     * Remove a PinnedIconButton, handing any window back to a normal button
+     */
+    protected void unpin_launcher(string key_name)
+    {
+        PinnedIconButton? btn = pin_buttons[key_name];
+        pin_buttons.unset(key_name);
+        pin_order.remove(key_name);
+
+        if (btn.window == null) {
+            btn.destroy();
+            return;
         }
+        /* We need to move this fella.. */
+        unowned Wnck.Window window = btn.window;
+        IconButton b2 = new IconButton(window, icon_size, btn.app_info);
+        untrack_button(window);
+        btn.destroy();
+        widget.pack_start(b2, false, false, 0);
+        track_button(window, b2);
+        b2.show_all();
     }
 } // End class
 
@@ -277,13 +277,14 @@ public class ClientWidget : Gtk.Box
             return;
         }
         string fname = uri.split("file://")[1];
-        try {
-            var pbuf = new Gdk.Pixbuf.from_file_at_size(fname, BACKGROUND_SIZE, BACKGROUND_SIZE);
-            background.set_from_pixbuf(pbuf);
-        } catch (Error e) {
+        var scale = background.get_scale_factor();
+        var pbuf = Budgie.IconCache.get_default().load_file(fname, BACKGROUND_SIZE, scale);
+        if (pbuf == null) {
             background.set_from_icon_name("emblem-music-symbolic", Gtk.IconSize.INVALID);
             background.pixel_size = BACKGROUND_SIZE;
+            return;
         }
+        Budgie.IconCache.set_image_from_pixbuf(background, pbuf, scale);
     }
 
     /**
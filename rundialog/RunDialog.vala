@@ -26,26 +26,38 @@ public class RunDialogItemImage : Gtk.Image
 
     public signal void animation_end();
 
+    private uint tick_id = 0;
+
     public override void show ()
     {
         if (animated) {
-            animation_show = true;
-            animation_start_time = get_monotonic_time();
-            add_tick_callback (on_tick);
+            restart ();
         } else {
             animation_end ();
         }
         base.show();
     }
 
+    /**
+     * (Re)start the reveal animation, i.e. when the image is reused
+     */
+    public void restart ()
+    {
+        animated = true;
+        animation_show = true;
+        animation_elapsed = 0;
+        animation_start_time = get_monotonic_time();
+        if (tick_id == 0) {
+            tick_id = add_tick_callback (on_tick);
+        }
+        queue_draw ();
+    }
+
     public override bool draw (Cairo.Context cr)
     {
         if (animated) {
             // if animation_show
-            double factor = (double) animation_elapsed / animation_duration;
-            if (factor > 1) {
-                factor = 1;
-            }
+            double factor = ((double) animation_elapsed / animation_duration).clamp (0, 1);
             if (animation_destroy) {
                 factor = 1 - factor;
             }
@@ -63,6 +75,7 @@ public class RunDialogItemImage : Gtk.Image
         animated = animation_duration > animation_elapsed;
         widget.queue_draw ();
         if (!animated) {
+            tick_id = 0;
             animation_end();
             return false;
         }
@@ -76,58 +89,272 @@ public class RunDialogItem : Gtk.Button
     public static int REQUEST_SIZE = 90;
 
     public RunDialogItemImage image;
+    protected Gtk.Label label;
+    protected int icon_size;
 
-    public DesktopAppInfo app;
+    public DesktopAppInfo? app = null;
 
-    public RunDialogItem(DesktopAppInfo app)
+    public RunDialogItem()
     {
-        this.app = app;
         this.relief = Gtk.ReliefStyle.NONE;
+        this.no_show_all = true;
 
         var box = new Gtk.Box(Gtk.Orientation.VERTICAL, 10);
         add(box);
         box.set_size_request (REQUEST_SIZE, 0);
         box.add (get_icon ());
         box.add (get_name ());
+        box.show_all ();
         clicked.connect(launch);
     }
 
     protected Gtk.Widget get_icon()
     {
         image = new RunDialogItemImage();
-        image.set_from_gicon (app.get_icon (), Gtk.IconSize.DIALOG);
+        Gtk.icon_size_lookup (Gtk.IconSize.DIALOG, out icon_size, null);
         return image;
     }
 
     protected Gtk.Label get_name()
     {
-        var name = new Gtk.Label(app.get_name ());
-        name.set_line_wrap (true);
-        name.set_ellipsize (Pango.EllipsizeMode.END);
-        name.max_width_chars = 1;
-        return name;
+        label = new Gtk.Label("");
+        label.set_line_wrap (true);
+        label.set_ellipsize (Pango.EllipsizeMode.END);
+        label.max_width_chars = 1;
+        return label;
+    }
+
+    /**
+     * Display the given application in this (pooled) item
+     */
+    public void set_app(DesktopAppInfo app)
+    {
+        // Do not animate if the item already shows this app
+        if (this.app != null && this.app.get_filename() == app.get_filename()) {
+            return;
+        }
+        this.app = app;
+        Budgie.IconCache.set_image_from_gicon (image, app.get_icon (), icon_size);
+        label.set_text (app.get_name ());
+        if (get_visible ()) {
+            image.restart ();
+        } else {
+            // Played once the item is shown
+            image.animated = true;
+        }
+    }
+
+    public override void show ()
+    {
+        if (image.animated) {
+            image.restart ();
+        }
+        base.show ();
+    }
+
+    /**
+     * Return the item to the pool
+     */
+    public void clear()
+    {
+        app = null;
+        hide ();
     }
 
     public void launch()
     {
+        if (app == null) {
+            return;
+        }
         try {
             app.launch (null, null);
+            Budgie.UsageStore.get_default ().record_launch (app.get_filename ());
         } catch (GLib.Error e) {
             stderr.printf("Error launching app: %s\n", e.message);
         }
     }
 }
+
+/**
+ * A single query for the search worker
+ */
+class RunDialogQuery
+{
+    public string? text;
+    public int serial;
+    /* Only prime GIO's desktop file index, don't deliver anything */
+    public bool warm_only = false;
+
+    public RunDialogQuery(string? text, int serial)
+    {
+        this.text = text;
+        this.serial = serial;
+    }
+}
+
+/**
+ * Runs application searches on a worker thread.
+ *
+ * Every keystroke queues a new query and supersedes the previous one: the
+ * worker skips straight to the newest queued query, abandons a search once
+ * a newer one is queued, and results for stale queries are never delivered.
+ */
+public class RunDialogSearch : Object
+{
+
+    private AsyncQueue<RunDialogQuery> queries;
+    private Thread<void*> thread;
+    private int serial = 0;
+
+    /**
+     * Emitted on the main loop with the results for the newest query, in
+     * DesktopAppInfo.search() tiers (best first)
+     */
+    public signal void results(string query, GenericArray<GenericArray<DesktopAppInfo>> tiers);
+
+    /**
+     * Whether a query is still waiting for its results
+     */
+    public bool pending { public get; private set; default = false; }
+
+    public RunDialogSearch()
+    {
+        queries = new AsyncQueue<RunDialogQuery>();
+        thread = new Thread<void*>("budgie-run-search", worker);
+    }
+
+    /**
+     * Search for the given text, dropping any earlier query
+     */
+    public void query(string text)
+    {
+        pending = true;
+        queries.push(new RunDialogQuery(text, AtomicInt.add(ref serial, 1) + 1));
+    }
+
+    /**
+     * Have the worker build GIO's desktop file index ahead of the first
+     * real query
+     */
+    public void warm_up()
+    {
+        var q = new RunDialogQuery("budgie", 0);
+        q.warm_only = true;
+        queries.push(q);
+    }
+
+    /**
+     * Drop any outstanding query
+     */
+    public void cancel()
+    {
+        pending = false;
+        AtomicInt.inc(ref serial);
+    }
+
+    /**
+     * Stop the worker thread
+     */
+    public void stop()
+    {
+        cancel();
+        queries.push(new RunDialogQuery(null, 0));
+        thread.join();
+    }
+
+    private bool is_stale(RunDialogQuery q)
+    {
+        return q.serial != AtomicInt.get(ref serial);
+    }
+
+    private void* worker()
+    {
+        while (true) {
+            var q = queries.pop();
+            RunDialogQuery? newer;
+            while ((newer = queries.try_pop()) != null) {
+                if (q.text == null) {
+                    break;
+                }
+                q = newer;
+            }
+            if (q.text == null) {
+                break;
+            }
+            if (q.warm_only) {
+                DesktopAppInfo.search(q.text);
+                continue;
+            }
+            if (is_stale(q)) {
+                continue;
+            }
+            var tiers = search_applications(q);
+            if (tiers != null) {
+                deliver(q, tiers);
+            }
+        }
+        return null;
+    }
+
+    private void deliver(RunDialogQuery q, GenericArray<GenericArray<DesktopAppInfo>> tiers)
+    {
+        Idle.add(()=> {
+            if (is_stale(q)) {
+                return false;
+            }
+            pending = false;
+            results(q.text, tiers);
+            return false;
+        });
+    }
+
+    /**
+     * Search for applications, bailing out as soon as q is superseded
+     */
+    private GenericArray<GenericArray<DesktopAppInfo>>? search_applications(RunDialogQuery q)
+    {
+        var result = new GenericArray<GenericArray<DesktopAppInfo>>();
+        string **[] search = DesktopAppInfo.search(q.text);
+        string **group;
+        string desktop;
+        int i = 0, j = 0;
+        while ((group = search[i]) != null) {
+            i++; j = 0;
+            var tier = new GenericArray<DesktopAppInfo>();
+            while ((desktop = group[j]) != null) {
+                j++;
+                if (is_stale(q)) {
+                    return null;
+                }
+                var app = new DesktopAppInfo(desktop);
+                if (app == null || app.get_nodisplay()) {
+                    continue;
+                }
+                tier.add(app);
+            }
+            result.add(tier);
+        }
+        return result;
+    }
+}
+
 public class RunDialog : Gtk.Window
 {
 
     private Gtk.SearchEntry entry;
     private Gtk.Grid grid;
     private RunDialogItem first_item;
+    private RunDialogItem[] items;
+    private RunDialogSearch search;
+    /* Enter was hit before the results for the current text arrived */
+    private bool activate_pending = false;
 
     private static string DEFAULT_ICON = "system-run-symbolic";
 
     private static int GRID_COLUMS = 3;
     private static int GRID_ROWS = 3;
+    /* Size of the item pool, i.e. the most results ever shown */
+    private static int MAX_RESULTS = GRID_COLUMS * GRID_ROWS * 2;
 
     protected Gtk.Revealer revealer;
     protected Gtk.Label exec;
@@ -137,7 +364,17 @@ public class RunDialog : Gtk.Window
     {
         // Initialisation stuffs
         window_position = Gtk.WindowPosition.CENTER;
-        destroy.connect(() => Gtk.main_quit());
+        // Load usage scores up front, and write out launches before we exit
+        Budgie.UsageStore.get_default();
+        destroy.connect(() => {
+            search.stop();
+            Budgie.UsageStore.get_default().flush();
+        });
+        // We're resident, so closing only ever hides us
+        delete_event.connect(() => {
+            dismiss ();
+            return true;
+        });
         set_keep_above(true);
         set_skip_taskbar_hint(true);
         set_skip_pager_hint(true);
@@ -156,6 +393,10 @@ public class RunDialog : Gtk.Window
         exec = new Gtk.Label("");
         description = new Gtk.Label("");
         var box_results = init_results_box (grid, revealer, exec, description);
+        init_items ();
+
+        search = new RunDialogSearch();
+        search.results.connect(on_results);
 
         var main_layout = new Gtk.Box(Gtk.Orientation.VERTICAL, 0);
         main_layout.pack_start(headerbar, false, false, 0);
@@ -183,7 +424,7 @@ public class RunDialog : Gtk.Window
         /* Finally, handle ESC */
         key_press_event.connect((w, e) => {
             if (e.keyval == Gdk.Key.Escape) {
-                this.destroy();
+                this.dismiss();
                 return true;
             }
             return false;
@@ -199,7 +440,50 @@ public class RunDialog : Gtk.Window
 
         get_settings().set_property("gtk-application-prefer-dark-theme", true);
         hide_results ();
-        show_all();
+        // Shown on demand by summon()
+        main_layout.show_all();
+        empty.show_all();
+        realize();
+
+        // Warm up the desktop file index while we're hidden
+        search.warm_up();
+    }
+
+    /**
+     * Show the dialog, ready for a new search
+     *
+     * @param timestamp Time of the triggering event, for focus stealing prevention
+     */
+    public void summon (uint32 timestamp)
+    {
+        entry.grab_focus ();
+        present_with_time (timestamp);
+    }
+
+    /**
+     * Hide the dialog and reset it for the next use. The process (and with
+     * it the app index and widgets) stays around.
+     */
+    public void dismiss ()
+    {
+        hide ();
+        activate_pending = false;
+        search.cancel ();
+        entry.set_text ("");
+        clean ();
+        hide_results ();
+    }
+
+    /**
+     * Show the dialog if hidden, otherwise hide it
+     */
+    public void toggle (uint32 timestamp)
+    {
+        if (get_visible ()) {
+            dismiss ();
+        } else {
+            summon (timestamp);
+        }
     }
 
 
@@ -208,50 +492,52 @@ public class RunDialog : Gtk.Window
      */
     protected void entry_changed ()
     {
-        var old_items = grid.get_children().copy();
-        // reverse the items, since we are going to check from position 0
-        old_items.reverse();
-        clean();
-
+        activate_pending = false;
         if (entry.text.length <= 0) {
+            search.cancel ();
+            clean ();
             hide_results ();
             return;
         }
+        search.query (entry.text);
+    }
 
-        List<DesktopAppInfo> apps = this.search_applications (entry.text);
+    /**
+     * Fill the item pool with the results for the current text
+     */
+    protected void on_results (string query, GenericArray<GenericArray<DesktopAppInfo>> tiers)
+    {
+        unowned Budgie.UsageStore usage = Budgie.UsageStore.get_default();
+        int n = 0;
+
+        for (int t = 0; t < tiers.length && n < MAX_RESULTS; t++) {
+            var tier = tiers[t];
+            // Equally good matches are ordered by usage, shared with the menu
+            tier.sort((a, b) => {
+                var sa = usage.get_score(a.get_filename());
+                var sb = usage.get_score(b.get_filename());
+                return sa > sb ? -1 : (sa < sb ? 1 : 0);
+            });
+            for (int i = 0; i < tier.length && n < MAX_RESULTS; i++) {
+                items[n].set_app (tier[i]);
+                items[n].show ();
+                n++;
+            }
+        }
+        for (int i = n; i < items.length; i++) {
+            items[i].clear ();
+        }
 
-        if (apps.length () == 0) {
+        if (n == 0) {
             hide_results ();
             return;
         }
-
         show_results ();
-        int i = 0, current_column = -1, current_row = -1;
-
-        foreach (DesktopAppInfo app in apps) {
-            var item = new RunDialogItem(app);
+        this.set_info (first_item);
 
-            // Do not animate if Item is already in the current position
-            var old_item = (RunDialogItem) old_items.nth_data(i);
-            var animated = (old_item == null || app.get_filename() != old_item.app.get_filename());
-
-            item.image.animated = animated;
-            item.clicked.connect(() => this.destroy ());
-            item.enter_notify_event.connect(() => this.set_info(item));
-            item.leave_notify_event.connect(() => this.set_info(null));
-            if (i == 0) {
-                // first item
-                first_item = item;
-                this.set_info (item);
-                item.get_style_context ().add_class ("suggested-action");
-            }
-            current_column = i % GRID_COLUMS;
-            if (current_column == 0) {
-                current_row++;
-            }
-            grid.attach (item, current_column, current_row, 1, 1);
-            item.show_all();
-            i++;
+        if (activate_pending) {
+            activate_pending = false;
+            entry_activated ();
         }
     }
 
@@ -263,7 +549,7 @@ public class RunDialog : Gtk.Window
     {
         try {
             Process.spawn_command_line_async ("budgie-panel --prefs");
-            this.destroy();
+            this.dismiss();
         } catch (SpawnError e) {
             stderr.printf ("Error launching budgie settings: %s\n",
                            e.message);
@@ -285,7 +571,7 @@ public class RunDialog : Gtk.Window
         var close = new Gtk.Button.from_icon_name ("window-close-symbolic",
                 Gtk.IconSize.MENU);
         close.relief = Gtk.ReliefStyle.NONE;
-        close.clicked.connect(() => this.destroy());
+        close.clicked.connect(() => this.dismiss());
 
         box.add(preferences);
         box.add(new Gtk.Separator (Gtk.Orientation.VERTICAL));
@@ -341,6 +627,9 @@ public class RunDialog : Gtk.Window
         if (item == null) {
             item = first_item;
         }
+        if (item.app == null) {
+            return false;
+        }
         description.set_text (item.app.get_description ());
         exec.set_text ("Execute command <%s>".printf(item.app.get_executable ()));
         return false;
@@ -351,11 +640,29 @@ public class RunDialog : Gtk.Window
      */
     protected void clean ()
     {
-        foreach (var c in grid.get_children()) {
-            grid.remove(c);
+        foreach (var item in items) {
+            item.clear ();
         }
     }
 
+    /**
+     * Build the fixed pool of result items, reused for every search
+     */
+    protected void init_items ()
+    {
+        items = new RunDialogItem[MAX_RESULTS];
+        for (int i = 0; i < MAX_RESULTS; i++) {
+            var item = new RunDialogItem();
+            item.clicked.connect(() => this.dismiss ());
+            item.enter_notify_event.connect(() => this.set_info(item));
+            item.leave_notify_event.connect(() => this.set_info(null));
+            grid.attach (item, i % GRID_COLUMS, i / GRID_COLUMS, 1, 1);
+            items[i] = item;
+        }
+        first_item = items[0];
+        first_item.get_style_context ().add_class ("suggested-action");
+    }
+
     /**
      * Show results
      */
@@ -372,33 +679,6 @@ public class RunDialog : Gtk.Window
         revealer.set_reveal_child(false);
     }
 
-    /**
-     * Search for applications
-     */
-    private List<DesktopAppInfo> search_applications (string pattern)
-    {
-        var result = new List<DesktopAppInfo>();
-        if (pattern.length == 0) {
-            return result;
-        }
-        string **[] search = DesktopAppInfo.search(pattern);
-        string **group;
-        string desktop;
-        int i = 0, j = 0;
-        while ((group = search[i]) != null) {
-            i++; j = 0;
-            while ((desktop = group[j]) != null) {
-                j++;
-                var app = new DesktopAppInfo(desktop);
-                if (app == null || app.get_nodisplay()) {
-                    continue;
-                }
-                result.append(app);
-            }
-        }
-        return result;
-    }
-
     /**
      * Handle activation of the entry
      */
@@ -407,9 +687,14 @@ public class RunDialog : Gtk.Window
         if (entry.text.length == 0) {
             return;
         }
-        if (first_item != null) {
+        if (search.pending) {
+            // Launch the top result once it is known
+            activate_pending = true;
+            return;
+        }
+        if (first_item.app != null) {
             first_item.launch ();
-            destroy();
+            dismiss();
         }
     }
 
@@ -419,16 +704,50 @@ class RunDialogMain : GLib.Application
 {
 
     static Budgie.RunDialog dialog;
+    /* Started with --resident, i.e. preloaded by budgie-wm */
+    static bool start_hidden = false;
 
-    public override void activate()
+    /**
+     * Create the dialog once, it then lives as long as the process
+     */
+    private void ensure_dialog()
     {
+        if (dialog != null) {
+            return;
+        }
         hold();
-        if (dialog == null) {
-            dialog = new Budgie.RunDialog();
-            Gtk.main();
+        dialog = new Budgie.RunDialog();
+        dialog.destroy.connect(() => {
+            dialog = null;
+            release();
+        });
+    }
+
+    public override void startup()
+    {
+        base.startup();
+
+        /* budgie-wm activates this over D-Bus (org.gtk.Actions) on the keybinding,
+         * with the event timestamp as the parameter */
+        var action = new SimpleAction("toggle", VariantType.UINT32);
+        action.activate.connect((p) => {
+            ensure_dialog();
+            dialog.toggle(p != null ? p.get_uint32() : Gdk.CURRENT_TIME);
+        });
+        add_action(action);
+
+        ensure_dialog();
+    }
+
+    public override void activate()
+    {
+        if (start_hidden) {
+            /* Only the preload itself stays hidden */
+            start_hidden = false;
+            return;
         }
-        dialog.present();
-        release();
+        ensure_dialog();
+        dialog.summon(Gdk.CURRENT_TIME);
     }
 
     private RunDialogMain()
@@ -444,9 +763,29 @@ class RunDialogMain : GLib.Application
         Budgie.RunDialogMain app;
         Gtk.init(ref args);
 
+        string[] app_args = { args[0] };
+        foreach (var arg in args[1:args.length]) {
+            if (arg == "--resident") {
+                start_hidden = true;
+            } else {
+                app_args += arg;
+            }
+        }
+
         app = new Budgie.RunDialogMain();
 
-        return app.run(args);
+        try {
+            app.register(null);
+        } catch (Error e) {
+            stderr.printf("Unable to register: %s\n", e.message);
+            return 1;
+        }
+        if (start_hidden && app.get_is_remote()) {
+            /* Already resident, nothing to preload */
+            return 0;
+        }
+
+        return app.run(app_args);
     }
 } // End RunDialogMain
 
@@ -14,24 +14,9 @@ namespace Budgie
 
     const string WM_NAME = "budgie-wm";
     const string PANEL_NAME = "budgie-panel";
-    /* Never attempt to relaunch something more than 3 times */
-    const int MAX_LAUNCH = 3;
-
-    /**
-     * Simple container class to monitor processes, and how many times they
-     * have been launched, etc.
-     */
-    protected class  WatchedProcess {
-
-        /** Current PID of the process */
-        public Pid pid { public get; public set; }
-
-        /** Number of times this process has been launched */
-        public int n_times { public get; public set; }
-
-         /** Command line for the process */
-        public string cmd_line { public get; public set; }
-    }
+    /* Bus names the WM and panel own once they're up */
+    const string WM_BUS_NAME = "com.evolve_os.BudgieWM";
+    const string PANEL_BUS_NAME = "com.evolve_os.BudgiePanel";
 
 /**
  * Budgie.Session is responsible for session management within the Budgie
@@ -43,8 +28,14 @@ public class Session : GLib.Application
     bool running = false;
     GLib.MainLoop loop = null;
     Gee.HashMap<string,WatchedProcess?> process_map;
+    SupervisorStats? stats = null;
+    uint stats_id = 0;
     // xdg mapping
     Gee.HashMap<string,DesktopAppInfo>  mapping;
+    // command lines of launched xdg items
+    Gee.HashSet<string> launched;
+    StartupScheduler scheduler;
+    StartupTrace trace;
     bool relaunch = true;
 
     /**
@@ -59,36 +50,79 @@ public class Session : GLib.Application
 
         hold();
         running = true;
-        prepare_xdg();
-        Gee.ArrayList<string?> launched = new Gee.ArrayList<string?>();
-
-        process_map = new Gee.HashMap<string,WatchedProcess?>(null,null,null);
-        launch_xdg("Initialization", ref launched);
-
-        /* Launch our items - want the window manager first */
-        if (!launch_watched(WM_NAME)) {
-            critical("Unable to launch %s", WM_NAME);
-            Process.exit(1);
-        }
-        launch_xdg("WindowManager", ref launched);
-
-        // Now we need all "init" style items
-        if (!launch_watched(PANEL_NAME)) {
-            critical("Unable to launch %s", PANEL_NAME);
+        trace = new StartupTrace();
+        if (process_map == null) {
+            process_map = new Gee.HashMap<string,WatchedProcess?>(null,null,null);
         }
-        // And now "panel" style items, where appropriate
-        launch_xdg("Panel", ref launched);
+        launched = new Gee.HashSet<string>(null, null);
 
-        // And now all you other fellers.
-        launch_xdg("Desktop", ref launched);
-        launch_xdg("Applications", ref launched);
+        scan_autostart.begin((obj, res)=> {
+            mapping = scan_autostart.end(res);
+            start_session();
+        });
 
-        launched = null;
         loop.run();
 
         release();
     }
 
+    /**
+     * Build the startup graph and set it going. Nodes start as soon as
+     * their dependencies are ready, so i.e. the panel and the "Desktop"
+     * phase come up side by side once the WM is ready.
+     */
+    protected void start_session()
+    {
+        scheduler = new StartupScheduler();
+        scheduler.node_started.connect((n)=> trace.node_started(n, scheduler.get_deps(n)));
+        scheduler.node_ready.connect(trace.node_ready);
+        scheduler.finished.connect(()=> {
+            message("Session startup complete");
+            trace.write();
+        });
+
+        scheduler.add("Initialization", {}, null, 0, ()=> {
+            launch_xdg("Initialization");
+            return true;
+        });
+        /* Want the window manager first */
+        scheduler.add(WM_NAME, { "Initialization" }, WM_BUS_NAME, 0, ()=> {
+            if (!launch_watched(WM_NAME)) {
+                critical("Unable to launch %s", WM_NAME);
+                Process.exit(1);
+            }
+            return true;
+        });
+        scheduler.add("WindowManager", { WM_NAME }, null, 0, ()=> {
+            launch_xdg("WindowManager");
+            return true;
+        });
+        scheduler.add(PANEL_NAME, { WM_NAME }, PANEL_BUS_NAME, 0, ()=> {
+            if (!launch_watched(PANEL_NAME)) {
+                critical("Unable to launch %s", PANEL_NAME);
+                return false;
+            }
+            return true;
+        });
+        // And now "panel" style items, where appropriate
+        scheduler.add("Panel", { PANEL_NAME }, null, 0, ()=> {
+            launch_xdg("Panel");
+            return true;
+        });
+        scheduler.add("Desktop", { "WindowManager" }, null, 0, ()=> {
+            launch_xdg("Desktop");
+            return true;
+        });
+        // And now all you other fellers, which may want a tray
+        scheduler.add("Applications", { "Desktop", PANEL_NAME }, null, 0, ()=> {
+            launch_xdg("Applications");
+            return true;
+        });
+        add_delayed_items();
+
+        scheduler.schedule();
+    }
+
     /**
      * Launch a process and keep it in a monitored state
      */
@@ -112,6 +146,7 @@ public class Session : GLib.Application
         if (!process_map.has_key(cmdline)) {
             p = new WatchedProcess();
             p.n_times = 0;
+            p.cmd_line = cmdline;
         } else {
             p = process_map[cmdline];
         }
@@ -125,12 +160,17 @@ public class Session : GLib.Application
             stderr.printf("Could not spawn command: %s\n", e.message);
             return false;
         }
+        /* Nothing to say to it */
+        Posix.close(fdin);
 
         p.pid = pid;
-        p.cmd_line = cmdline;
+        p.running = true;
+        p.started = get_monotonic_time();
         // Increment the times we've launched this fella
         p.n_times += 1;
+        p.watch_output(fdout, fderr);
         process_map[cmdline] = p;
+        trace.spawned(cmdline, pid);
         /* Watch the child and see if it dies */
         ChildWatch.add(pid, child_reaper);
 
@@ -138,43 +178,91 @@ public class Session : GLib.Application
     }
 
     /**
-     * Handle processes that died
+     * Handle processes that died, restarting crashed ones with an
+     * exponential backoff until their restart budget runs out.
      */
     protected void child_reaper(Pid pid, int status)
     {
         WatchedProcess? p = null;
 
         foreach (var process in process_map.values) {
-            if (process.pid == pid) {
+            if (process.running && process.pid == pid) {
                 p = process;
                 break;
             }
         }
 
+        trace.exited(pid, status);
+        Process.close_pid(pid);
+        if (p == null) {
+            return;
+        }
+
         stdout.printf("%d (%s) closed with exit code: %d\n", pid, p.cmd_line, status);
         stdout.printf("Launched %d times\n", p.n_times);
 
-        Process.close_pid(pid);
-        /* Relaunch borked processes only */
-        if (p.n_times < MAX_LAUNCH && status != 0 && relaunch) {
-            Idle.add(()=> {
-                launch_watched(p.cmd_line);
-                return false;
-            });
+        p.running = false;
+        p.last_status = status;
+        p.last_exit = get_real_time();
+
+        /* Relaunch borked processes only, otherwise it was a normal requested operation */
+        if (status == 0 || !relaunch) {
+            return;
+        }
+
+        if (get_monotonic_time() - p.started >= STABLE_UPTIME * 1000000) {
+            /* It had been fine for a while, so start the backoff over */
+            p.failures = 0;
+        }
+        p.failures++;
+
+        if (!p.take_restart()) {
+            p.gave_up = true;
+            warning("Not relaunching %s as it has crashed %d times within %s seconds. Last output:\n%s",
+                p.cmd_line, RESTART_BUDGET, RESTART_WINDOW.to_string(), p.stderr_ring.to_string());
+            /* Now, if WM is dead or PANEL is dead we need to go bail. In future, handle
+             * this more gracefully. Like, a failwhale. Or squirrel. >_> */
+            if (p.cmd_line == WM_NAME || p.cmd_line == PANEL_NAME) {
+                critical("Critical desktop component %s exited with status code %d", p.cmd_line, status);
+                do_logout();
+                loop.quit();
+            }
             return;
-        } else {
-            if (status != 0) {
-                warning("Not relaunching %s as it has died 3 times already", p.cmd_line);
-                /* Now, if WM is dead or PANEL is dead we need to go bail. In future, handle
-                 * this more gracefully. Like, a failwhale. Or squirrel. >_> */
-                if (p.cmd_line == WM_NAME || p.cmd_line == PANEL_NAME) {
-                    critical("Critical desktop component %s exited with status code %d", p.cmd_line, status);
-                    do_logout();
-                    loop.quit();
-                }
-            } // otherwise it was a normal requested operation
-            process_map.unset(p.cmd_line);
         }
+
+        p.next_restart_delay = p.backoff_delay();
+        message("Relaunching %s in %ums", p.cmd_line, p.next_restart_delay);
+        p.restart_id = Timeout.add(p.next_restart_delay, ()=> {
+            p.restart_id = 0;
+            if (relaunch) {
+                launch_watched(p.cmd_line);
+            }
+            return false;
+        });
+    }
+
+    public override bool dbus_register(DBusConnection connection, string object_path) throws Error
+    {
+        if (!base.dbus_register(connection, object_path)) {
+            return false;
+        }
+        if (process_map == null) {
+            /* Registration happens before activate() */
+            process_map = new Gee.HashMap<string,WatchedProcess?>(null,null,null);
+        }
+        stats = new SupervisorStats(process_map);
+        stats_id = connection.register_object(object_path, stats);
+        return true;
+    }
+
+    public override void dbus_unregister(DBusConnection connection, string object_path)
+    {
+        if (stats_id > 0) {
+            connection.unregister_object(stats_id);
+            stats_id = 0;
+        }
+        stats = null;
+        base.dbus_unregister(connection, object_path);
     }
 
     /*
@@ -188,14 +276,19 @@ public class Session : GLib.Application
         }
 
         hold();
+        trace.mark("logout");
+        trace.write();
         // just in case sending SIGTERM results in some oddity in a watched
         // process
         relaunch = false;
         // Kill processes that we explicitly own
         foreach (var process in process_map.values) {
-            if (process.n_times < MAX_LAUNCH) {
+            if (process.restart_id > 0) {
+                Source.remove(process.restart_id);
+                process.restart_id = 0;
+            }
+            if (process.running) {
                 Posix.kill(process.pid, ProcessSignal.TERM);
-                Process.close_pid(process.pid);
             }
         }
         loop.quit();
@@ -203,71 +296,58 @@ public class Session : GLib.Application
     }
 
     /**
-     * Iterate the xdg autostarts
+     * Determine the phase an entry belongs to, or null if it is for a phase
+     * we don't handle.
+     *
+     * Note: "Applications" is also a catch-call for anything that is *not*
+     * categorised
      */
-    private void prepare_xdg()
+    protected string? get_phase(DesktopAppInfo entry)
     {
-        mapping = new Gee.HashMap<string,DesktopAppInfo>(null,null,null);
-
-        /* Layered from left to right - user at the end can override all */
-        var xdgdirs = Environment.get_system_config_dirs();
-        xdgdirs += Environment.get_user_config_dir();
+        if (entry.has_key("X-GNOME-Autostart-Phase")) {
+            var phase = entry.get_string("X-GNOME-Autostart-Phase");
+            switch (phase) {
+                case "Initialization":
+                case "WindowManager":
+                case "Panel":
+                case "Desktop":
+                case "Applications":
+                    return phase;
+                default:
+                    return null;
+            }
+        }
+        return "Applications";
+    }
 
-        foreach (var dir in xdgdirs) {
-            var startdir = @"$dir/autostart";
-            var file = File.new_for_path(startdir);
-            var info = file.query_file_type(FileQueryInfoFlags.NONE, null);
-            FileInfo? next_info;
+    /**
+     * Delay for an entry in seconds, as per X-GNOME-Autostart-Delay
+     */
+    protected uint get_delay(DesktopAppInfo entry)
+    {
+        if (entry.has_key("X-GNOME-Autostart-Delay")) {
+            return (uint)int.parse(entry.get_string("X-GNOME-Autostart-Delay")).clamp(0, int.MAX);
+        }
+        return 0;
+    }
 
-            if (info != FileType.DIRECTORY) {
+    /**
+     * Delayed entries become nodes of their own, started the given number
+     * of seconds after their phase.
+     */
+    protected void add_delayed_items()
+    {
+        foreach (var path in mapping.keys) {
+            var entry = mapping[path];
+            var phase = get_phase(entry);
+            var delay = get_delay(entry);
+            if (phase == null || delay == 0) {
                 continue;
             }
-
-            try {
-                var listing = file.enumerate_children("standard::*", FileQueryInfoFlags.NONE, null);
-
-                /* Iterate children */
-                while ((next_info = listing.next_file(null)) != null) {
-                    try {
-                        var path = next_info.get_name();
-                        if (!path.has_suffix(".desktop")) {
-                            continue;
-                        }
-                        var fullpath = @"$startdir/$path";
-                        var nfile = File.new_for_path(fullpath);
-                        var cinfo = nfile.query_info("standard::*", FileQueryInfoFlags.NONE, null);
-                        if (cinfo.get_is_symlink()) {
-                            /* If this is a link to /dev/null its disabled */
-                            if (cinfo.get_symlink_target() == "/dev/null") {
-                                // Remove from the previously built table
-                                if (mapping.has_key(path)) {
-                                    mapping.unset(path);
-                                    continue;
-                                }
-                            }
-                        }
-
-                        var appinfo = new DesktopAppInfo.from_filename(fullpath);
-                        if (appinfo == null) {
-                            continue;
-                        }
-                        if (should_autostart(ref appinfo)) {
-                            /* Quite simply, always override the same .desktop file names
-                             * from the previous run for a layering effect */
-                            mapping[path] = appinfo;
-                        } else {
-                            /* Overridden layer might have changed something */
-                            if (mapping.has_key(path)) {
-                                mapping.unset(path);
-                            }
-                        }
-                    } catch (Error e) {
-                        stderr.printf("Error: %s\n", e.message);
-                    }
-                }
-            } catch (Error e) {
-                stderr.printf("Error: %s\n", e.message);
-            }
+            scheduler.add(path, { phase }, null, delay, ()=> {
+                launch_entry(path, entry);
+                return true;
+            });
         }
     }
 
@@ -275,95 +355,60 @@ public class Session : GLib.Application
      * Launch session entries conforming to NewGnomeSession
      * https://wiki.gnome.org/Projects/SessionManagement/NewGnomeSession
      *
-     * Note: "Applications" is also a catch-call for anything that is *not*
-     * categorised
+     * Everything in the phase is started in one go, delayed items are left
+     * to their own nodes.
      */
-    protected void launch_xdg(string condition, ref Gee.ArrayList<string?> launched_items)
+    protected void launch_xdg(string condition)
     {
-        foreach (var entry in mapping.values) {
-            bool launch = false;
-            bool monitor = false;
-            int delay = 0;
-
-            if (entry.get_commandline() in launched_items) {
+        foreach (var path in mapping.keys) {
+            var entry = mapping[path];
+            if (get_phase(entry) != condition || get_delay(entry) > 0) {
                 continue;
             }
-            launched_items.add(entry.get_commandline());
-
-            if (entry.has_key("X-GNOME-Autostart-Phase")) {
-                var phase = entry.get_string("X-GNOME-Autostart-Phase");
-                if (condition != phase) {
-                    continue;
-                }
-                launch = true;
-            } else if (condition == "Applications") {
-                launch = true;
-            }
-            // determine if we need to monitor it
-            if (entry.has_key("X-GNOME-AutoRestart")) {
-                monitor = entry.get_boolean("X-GNOME-AutoRestart");
-            }
-            // does it need a delay?
-            if (entry.has_key("X-GNOME-Autostart-Delay")) {
-                string del = entry.get_string("X-GNOME-Autostart-Delay");
-                delay = int.parse(del);
-            }
-
-            /* So, go launch it. */
-            try {
-                if (monitor) {
-                    /* Monitored processes are handled by us */
-                    if (delay > 0) {
-                        Timeout.add(delay, ()=> {
-                            launch_watched(entry.get_commandline());
-                            return false;
-                        });
-                    } else {
-                        launch_watched(entry.get_commandline());
-                    }
-                } else {
-                    if (delay > 0) {
-                        Timeout.add(delay, ()=> {
-                            entry.launch(null, null);
-                            return false;
-                        });
-                    } else {
-                        entry.launch(null, null);
-                    }
-                }
-            } catch (Error e) {
-                warning("Unable to launch item: %s", e.message);
-            }
+            launch_entry(path, entry);
         }
     }
 
-    protected bool should_autostart(ref DesktopAppInfo info)
+    /**
+     * Launch a single autostart entry, once
+     *
+     * @param path The entry's .desktop file name, identifying it in the trace
+     */
+    protected void launch_entry(string path, DesktopAppInfo entry)
     {
-        bool ret = true;
-        /* First condition, check we should show */
-        if (info.has_key("OnlyShowIn")) {
-            var showin = info.get_string("OnlyShowIn");
-            if ("Budgie;" in showin || "GNOME;" in showin) {
-                ret = true;
-            } else {
-                ret = false;
-            }
+        bool monitor = false;
+
+        if (entry.get_commandline() in launched) {
+            return;
         }
+        launched.add(entry.get_commandline());
 
-        if (!ret) {
-            return ret;
+        // determine if we need to monitor it
+        if (entry.has_key("X-GNOME-AutoRestart")) {
+            monitor = entry.get_boolean("X-GNOME-AutoRestart");
         }
 
-        /* Secondly, determine if its a gsettings key step */
-        if (info.has_key("AutostartCondition")) {
-            var splits = info.get_string("AutostartCondition").split(" ", 3);
-            if (splits[0] != "GSettings") {
-                return false;
+        /* So, go launch it. */
+        try {
+            if (monitor) {
+                /* Monitored processes are handled by us */
+                launch_watched(entry.get_commandline());
+            } else {
+                /* Not relaunched, but still reaped by us for the trace */
+                var name = path;
+                entry.launch_uris_as_manager(null, null,
+                    SpawnFlags.SEARCH_PATH | SpawnFlags.DO_NOT_REAP_CHILD, null,
+                    (info, pid)=> {
+                        trace.spawned(name, pid);
+                        ChildWatch.add(pid, (p, status)=> {
+                            trace.exited(p, status);
+                            Process.close_pid(p);
+                        });
+                    });
             }
-            var settings = new Settings(splits[1]);
-            return settings.get_boolean(splits[2]) == true;
+        } catch (Error e) {
+            warning("Unable to launch item: %s", e.message);
         }
-        return true;
     }
 
     private Session()
@@ -376,12 +421,23 @@ public class Session : GLib.Application
             do_logout();
         });
         add_action(action);
+
+        /* Milestones reported by the desktop components, for the startup trace */
+        action = new SimpleAction("trace-mark", VariantType.STRING);
+        action.activate.connect((p)=> {
+            if (trace != null) {
+                trace.mark(p.get_string());
+            }
+        });
+        add_action(action);
     }
 
     static bool should_logout = false;
+    static bool trace_summary = false;
 
 	private const GLib.OptionEntry[] options = {
         { "logout", 0, 0, OptionArg.NONE, ref should_logout, "Logout", null },
+        { "trace-summary", 0, 0, OptionArg.NONE, ref trace_summary, "Summarize a startup trace (default: the latest)", null },
         { null }
     };
 
@@ -402,6 +458,15 @@ public class Session : GLib.Application
             return 0;
         }
 
+        if (trace_summary) {
+            var path = args.length > 1 ? args[1] : StartupTrace.find_latest();
+            if (path == null) {
+                stderr.printf("No startup traces found in %s\n", StartupTrace.get_trace_dir());
+                return 1;
+            }
+            return StartupTrace.summarize(path);
+        }
+
         if (!should_logout) {
             if (Environment.get_variable("DBUS_SESSION_BUS_ADDRESS") == null) {
                 string[] cmd = { "dbus-launch", "--exit-with-session" };
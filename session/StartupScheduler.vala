@@ -0,0 +1,339 @@
+/*
+ * StartupScheduler.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+namespace Budgie
+{
+
+    /* Seconds to wait for a component to signal readiness before carrying on anyway */
+    const uint READY_TIMEOUT = 10;
+
+    /* Number of directory entries to request per batch while scanning */
+    const int SCAN_BATCH = 32;
+
+    /**
+     * Start a node's work, returning false if it failed
+     */
+    public delegate bool StartupFunc();
+
+    /**
+     * A single step in the startup graph, i.e. a component or the items of
+     * an autostart phase.
+     */
+    public class StartupNode {
+
+        public string name;
+        /** Nodes that must be ready before this one may start */
+        public string[] deps;
+        /** D-Bus name owned once this node is usable, or null if starting is enough */
+        public string? ready_name;
+        /** Seconds to wait after the dependencies are ready */
+        public uint delay;
+        public StartupFunc func;
+
+        public bool started = false;
+        public bool ready = false;
+        public uint watch_id = 0;
+        public uint timeout_id = 0;
+
+        public StartupNode(string name, string[] deps, string? ready_name, uint delay, owned StartupFunc func)
+        {
+            this.name = name;
+            this.deps = deps;
+            this.ready_name = ready_name;
+            this.delay = delay;
+            this.func = (owned)func;
+        }
+    }
+
+    /**
+     * Starts nodes as soon as everything they depend on is ready, so that
+     * independent nodes come up concurrently rather than in a fixed order.
+     */
+    public class StartupScheduler : Object {
+
+        HashTable<string,StartupNode> nodes;
+        GenericArray<StartupNode> order;
+        bool finished_emitted = false;
+
+        /**
+         * Emitted when a node has been started
+         */
+        public signal void node_started(string name);
+
+        /**
+         * Emitted when a node became ready, or timed out trying
+         */
+        public signal void node_ready(string name, bool timed_out);
+
+        /**
+         * Emitted once every node is ready
+         */
+        public signal void finished();
+
+        public StartupScheduler()
+        {
+            nodes = new HashTable<string,StartupNode>(str_hash, str_equal);
+            order = new GenericArray<StartupNode>();
+        }
+
+        /**
+         * Add a node to the graph. Dependencies on unknown nodes are ignored.
+         */
+        public void add(string name, string[] deps, string? ready_name, uint delay, owned StartupFunc func)
+        {
+            var node = new StartupNode(name, deps, ready_name, delay, (owned)func);
+            nodes.insert(name, node);
+            order.add(node);
+        }
+
+        /**
+         * Dependencies of the given node
+         */
+        public string[] get_deps(string name)
+        {
+            unowned StartupNode? node = nodes.lookup(name);
+            return node != null ? node.deps : new string[] {};
+        }
+
+        /**
+         * Start everything that can be started right now
+         */
+        public void schedule()
+        {
+            for (int i = 0; i < order.length; i++) {
+                var node = order[i];
+                if (node.started || !deps_ready(node)) {
+                    continue;
+                }
+                node.started = true;
+                if (node.delay > 0) {
+                    node.timeout_id = Timeout.add_seconds(node.delay, ()=> {
+                        node.timeout_id = 0;
+                        start(node);
+                        return false;
+                    });
+                } else {
+                    start(node);
+                }
+            }
+        }
+
+        bool deps_ready(StartupNode node)
+        {
+            foreach (var dep in node.deps) {
+                unowned StartupNode? d = nodes.lookup(dep);
+                if (d != null && !d.ready) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void start(StartupNode node)
+        {
+            if (!node.func()) {
+                warning("Startup of %s failed", node.name);
+            }
+            node_started(node.name);
+
+            if (node.ready_name == null) {
+                mark_ready(node, false);
+                return;
+            }
+            node.watch_id = Bus.watch_name(BusType.SESSION, node.ready_name,
+                BusNameWatcherFlags.NONE, ()=> {
+                    mark_ready(node, false);
+                }, null);
+            node.timeout_id = Timeout.add_seconds(READY_TIMEOUT, ()=> {
+                node.timeout_id = 0;
+                warning("%s did not become ready in %u seconds", node.name, READY_TIMEOUT);
+                mark_ready(node, true);
+                return false;
+            });
+        }
+
+        void mark_ready(StartupNode node, bool timed_out)
+        {
+            if (node.ready) {
+                return;
+            }
+            node.ready = true;
+            if (node.timeout_id > 0) {
+                Source.remove(node.timeout_id);
+                node.timeout_id = 0;
+            }
+            if (node.watch_id > 0) {
+                /* Can't unwatch from within the watcher callback itself */
+                var id = node.watch_id;
+                node.watch_id = 0;
+                Idle.add(()=> {
+                    Bus.unwatch_name(id);
+                    return false;
+                });
+            }
+            node_ready(node.name, timed_out);
+            schedule();
+
+            /* schedule() may have readied everything already, further down */
+            if (finished_emitted) {
+                return;
+            }
+            for (int i = 0; i < order.length; i++) {
+                if (!order[i].ready) {
+                    return;
+                }
+            }
+            finished_emitted = true;
+            finished();
+        }
+    }
+
+    /**
+     * Scan the XDG autostart directories asynchronously.
+     *
+     * All directories are scanned concurrently, and their .desktop files
+     * read without blocking the main loop. The results are then
+     * layered from left to right so the user directory can override all.
+     *
+     * @return a mapping of .desktop file name to the items that should start
+     */
+    public async Gee.HashMap<string,DesktopAppInfo> scan_autostart()
+    {
+        var mapping = new Gee.HashMap<string,DesktopAppInfo>(null,null,null);
+
+        var xdgdirs = Environment.get_system_config_dirs();
+        xdgdirs += Environment.get_user_config_dir();
+
+        var layers = new Gee.HashMap<string,DesktopAppInfo?>[xdgdirs.length];
+        int pending = xdgdirs.length;
+        SourceFunc callback = scan_autostart.callback;
+
+        for (int i = 0; i < xdgdirs.length; i++) {
+            int layer = i;
+            scan_dir.begin(@"$(xdgdirs[i])/autostart", (obj, res)=> {
+                layers[layer] = scan_dir.end(res);
+                pending--;
+                if (pending == 0) {
+                    callback();
+                }
+            });
+        }
+        if (pending > 0) {
+            yield;
+        }
+
+        for (int i = 0; i < xdgdirs.length; i++) {
+            foreach (var entry in layers[i].entries) {
+                var path = entry.key;
+                var appinfo = entry.value;
+                /* Masked (linked to /dev/null) or not for us, so disable the lower layers too.
+                 * Otherwise, quite simply, always override the same .desktop file names
+                 * from the previous layer for a layering effect */
+                if (appinfo != null && should_autostart(appinfo)) {
+                    mapping[path] = appinfo;
+                } else if (mapping.has_key(path)) {
+                    mapping.unset(path);
+                }
+            }
+        }
+        return mapping;
+    }
+
+    /**
+     * Load the .desktop files in a single autostart directory
+     *
+     * @return a mapping of .desktop file name to its contents, or null if
+     * it's masked. Unreadable and invalid files are left out, they don't
+     * mask anything.
+     */
+    async Gee.HashMap<string,DesktopAppInfo?> scan_dir(string startdir)
+    {
+        var ret = new Gee.HashMap<string,DesktopAppInfo?>(null,null,null);
+        var file = File.new_for_path(startdir);
+
+        try {
+            var listing = yield file.enumerate_children_async(FileAttribute.STANDARD_NAME + "," +
+                FileAttribute.STANDARD_IS_SYMLINK + "," + FileAttribute.STANDARD_SYMLINK_TARGET,
+                FileQueryInfoFlags.NONE, Priority.DEFAULT, null);
+            while (true) {
+                var infos = yield listing.next_files_async(SCAN_BATCH, Priority.DEFAULT, null);
+                if (infos == null) {
+                    break;
+                }
+                foreach (var info in infos) {
+                    var path = info.get_name();
+                    if (!path.has_suffix(".desktop")) {
+                        continue;
+                    }
+                    /* If this is a link to /dev/null its disabled */
+                    if (info.get_is_symlink() && info.get_symlink_target() == "/dev/null") {
+                        ret[path] = null;
+                        continue;
+                    }
+                    var appinfo = yield load_desktop_file(file.get_child(path));
+                    if (appinfo != null) {
+                        ret[path] = appinfo;
+                    }
+                }
+            }
+        } catch (Error e) {
+            if (!(e is IOError.NOT_FOUND)) {
+                stderr.printf("Error: %s\n", e.message);
+            }
+        }
+        return ret;
+    }
+
+    async DesktopAppInfo? load_desktop_file(File file)
+    {
+        uint8[] contents;
+        var kf = new KeyFile();
+
+        try {
+            yield file.load_contents_async(null, out contents, null);
+            kf.load_from_data((string)contents, contents.length, KeyFileFlags.NONE);
+        } catch (Error e) {
+            warning("Ignoring %s: %s", file.get_path(), e.message);
+            return null;
+        }
+        return new DesktopAppInfo.from_keyfile(kf);
+    }
+
+    bool should_autostart(DesktopAppInfo info)
+    {
+        bool ret = true;
+        /* First condition, check we should show */
+        if (info.has_key("OnlyShowIn")) {
+            var showin = info.get_string("OnlyShowIn");
+            if ("Budgie;" in showin || "GNOME;" in showin) {
+                ret = true;
+            } else {
+                ret = false;
+            }
+        }
+
+        if (!ret) {
+            return ret;
+        }
+
+        /* Secondly, determine if its a gsettings key step */
+        if (info.has_key("AutostartCondition")) {
+            var splits = info.get_string("AutostartCondition").split(" ", 3);
+            if (splits[0] != "GSettings") {
+                return false;
+            }
+            var settings = new Settings(splits[1]);
+            return settings.get_boolean(splits[2]) == true;
+        }
+        return true;
+    }
+
+} // End Budgie namespace
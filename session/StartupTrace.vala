@@ -0,0 +1,441 @@
+/*
+ * StartupTrace.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+namespace Budgie
+{
+
+    /* Number of per-login traces to keep around */
+    const int MAX_TRACES = 10;
+
+    /**
+     * A single recorded event, timestamps are in microseconds since the
+     * session started.
+     */
+    public class TraceEvent {
+
+        /** "node", "spawn" or "mark" */
+        public string category;
+        public string name;
+        public int64 start;
+        /** End of the span, or -1 for an instant/unfinished event */
+        public int64 end = -1;
+        public Pid pid = 0;
+        public int status = 0;
+        public bool timed_out = false;
+        public string? deps = null;
+
+        public TraceEvent(string category, string name, int64 start)
+        {
+            this.category = category;
+            this.name = name;
+            this.start = start;
+        }
+    }
+
+    /**
+     * Records when every part of the session was spawned, became ready and
+     * exited, and writes it out per login in Chrome's trace event format
+     * (load it in chrome://tracing, or summarize with --trace-summary).
+     *
+     * Traces live in $XDG_CACHE_HOME/budgie-desktop/startup/
+     */
+    public class StartupTrace {
+
+        int64 t0;
+        string path;
+        GenericArray<TraceEvent> events;
+        HashTable<string,TraceEvent> nodes;
+        HashTable<int,TraceEvent> spawns;
+
+        public StartupTrace()
+        {
+            t0 = get_monotonic_time();
+            events = new GenericArray<TraceEvent>();
+            nodes = new HashTable<string,TraceEvent>(str_hash, str_equal);
+            spawns = new HashTable<int,TraceEvent>(direct_hash, direct_equal);
+
+            var now = new DateTime.now_local();
+            path = Path.build_filename(get_trace_dir(), "session-%s.json".printf(now.format("%Y%m%d-%H%M%S")));
+        }
+
+        public static string get_trace_dir()
+        {
+            return Path.build_filename(Environment.get_user_cache_dir(), "budgie-desktop", "startup");
+        }
+
+        int64 now()
+        {
+            return get_monotonic_time() - t0;
+        }
+
+        /**
+         * A startup node was started, see StartupScheduler
+         */
+        public void node_started(string name, string[] deps)
+        {
+            var ev = new TraceEvent("node", name, now());
+            ev.deps = string.joinv(",", deps);
+            nodes.insert(name, ev);
+            events.add(ev);
+        }
+
+        /**
+         * A startup node became ready
+         */
+        public void node_ready(string name, bool timed_out)
+        {
+            unowned TraceEvent? ev = nodes.lookup(name);
+            if (ev == null) {
+                return;
+            }
+            ev.end = now();
+            ev.timed_out = timed_out;
+        }
+
+        /**
+         * A process was spawned
+         */
+        public void spawned(string name, Pid pid)
+        {
+            var ev = new TraceEvent("spawn", name, now());
+            ev.pid = pid;
+            spawns.insert((int)pid, ev);
+            events.add(ev);
+        }
+
+        /**
+         * A spawned process exited
+         */
+        public void exited(Pid pid, int status)
+        {
+            unowned TraceEvent? ev = spawns.lookup((int)pid);
+            if (ev == null) {
+                return;
+            }
+            ev.end = now();
+            ev.status = status;
+            spawns.remove((int)pid);
+        }
+
+        /**
+         * Readiness (or other) milestone reported by a component
+         */
+        public void mark(string name)
+        {
+            events.add(new TraceEvent("mark", name, now()));
+        }
+
+        /**
+         * Write the trace so far, replacing any earlier write for this login
+         */
+        public void write()
+        {
+            var sb = new StringBuilder("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+            for (int i = 0; i < events.length; i++) {
+                var ev = events[i];
+                /* One event per line, so --trace-summary can read it back simply */
+                sb.append_printf("{\"cat\":%s,\"name\":%s,\"ts\":%s,\"pid\":%d,\"tid\":%d",
+                    quote(ev.category), quote(ev.name), ev.start.to_string(),
+                    Posix.getpid(), (int)ev.pid);
+                if (ev.category == "mark") {
+                    sb.append(",\"ph\":\"i\",\"s\":\"g\"");
+                } else if (ev.end >= 0) {
+                    sb.append_printf(",\"ph\":\"X\",\"dur\":%s", (ev.end - ev.start).to_string());
+                } else {
+                    /* Still running, or never became ready */
+                    sb.append(",\"ph\":\"i\",\"s\":\"t\"");
+                }
+                sb.append_printf(",\"args\":{\"status\":%d,\"timed_out\":%s,\"deps\":%s}}",
+                    ev.status, ev.timed_out ? "true" : "false", quote(ev.deps ?? ""));
+                sb.append(i < events.length - 1 ? ",\n" : "\n");
+            }
+            sb.append("]}\n");
+
+            try {
+                DirUtils.create_with_parents(get_trace_dir(), 00755);
+                FileUtils.set_contents(path, sb.str);
+            } catch (Error e) {
+                warning("Unable to write startup trace %s: %s", path, e.message);
+                return;
+            }
+            prune();
+        }
+
+        /**
+         * Only keep the most recent traces
+         */
+        void prune()
+        {
+            var names = new GenericArray<string>();
+            try {
+                var dir = Dir.open(get_trace_dir());
+                unowned string? name;
+                while ((name = dir.read_name()) != null) {
+                    if (name.has_prefix("session-") && name.has_suffix(".json")) {
+                        names.add(name);
+                    }
+                }
+            } catch (Error e) {
+                return;
+            }
+            if (names.length <= MAX_TRACES) {
+                return;
+            }
+            /* Timestamped names, so these sort oldest first */
+            names.sort(strcmp);
+            for (int i = 0; i < names.length - MAX_TRACES; i++) {
+                FileUtils.unlink(Path.build_filename(get_trace_dir(), names[i]));
+            }
+        }
+
+        static string quote(string s)
+        {
+            var sb = new StringBuilder("\"");
+            unichar c;
+            int i = 0;
+            while (s.get_next_char(ref i, out c)) {
+                switch (c) {
+                    case '"':
+                        sb.append("\\\"");
+                        break;
+                    case '\\':
+                        sb.append("\\\\");
+                        break;
+                    default:
+                        if (c < 0x20) {
+                            sb.append_printf("\\u%04x", (uint)c);
+                        } else {
+                            sb.append_unichar(c);
+                        }
+                        break;
+                }
+            }
+            sb.append_c('"');
+            return sb.str;
+        }
+
+        static string unquote(string s)
+        {
+            var sb = new StringBuilder();
+            unichar c;
+            int i = 0;
+            bool escaped = false;
+            while (s.get_next_char(ref i, out c)) {
+                if (escaped) {
+                    if (c == 'u' && i + 4 <= s.length) {
+                        sb.append_unichar((unichar)long.parse("0x" + s.substring(i, 4)));
+                        i += 4;
+                    } else {
+                        sb.append_unichar(c);
+                    }
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else {
+                    sb.append_unichar(c);
+                }
+            }
+            return sb.str;
+        }
+
+        /**
+         * Read back a trace written by write()
+         */
+        static GenericArray<TraceEvent>? load(string path)
+        {
+            string contents;
+            Regex field;
+            try {
+                FileUtils.get_contents(path, out contents);
+                field = new Regex("\"(\\w+)\":(\"(?:[^\"\\\\]|\\\\.)*\"|[-\\w.]+)");
+            } catch (Error e) {
+                stderr.printf("Unable to read %s: %s\n", path, e.message);
+                return null;
+            }
+
+            var ret = new GenericArray<TraceEvent>();
+            foreach (var line in contents.split("\n")) {
+                if (!line.has_prefix("{\"cat\"")) {
+                    continue;
+                }
+                var ev = new TraceEvent("", "", 0);
+                int64 dur = -1;
+                MatchInfo info;
+                field.match(line, 0, out info);
+                while (info.matches()) {
+                    var key = info.fetch(1);
+                    var val = info.fetch(2);
+                    if (val.has_prefix("\"")) {
+                        val = unquote(val.substring(1, val.length - 2));
+                    }
+                    switch (key) {
+                        case "cat":
+                            ev.category = val;
+                            break;
+                        case "name":
+                            ev.name = val;
+                            break;
+                        case "ts":
+                            ev.start = int64.parse(val);
+                            break;
+                        case "dur":
+                            dur = int64.parse(val);
+                            break;
+                        case "tid":
+                            ev.pid = (Pid)int.parse(val);
+                            break;
+                        case "status":
+                            ev.status = int.parse(val);
+                            break;
+                        case "timed_out":
+                            ev.timed_out = val == "true";
+                            break;
+                        case "deps":
+                            ev.deps = val;
+                            break;
+                        default:
+                            break;
+                    }
+                    try {
+                        info.next();
+                    } catch (RegexError e) {
+                        break;
+                    }
+                }
+                if (dur >= 0) {
+                    ev.end = ev.start + dur;
+                }
+                ret.add(ev);
+            }
+            return ret;
+        }
+
+        /**
+         * Find the most recent trace on disk
+         */
+        public static string? find_latest()
+        {
+            string? latest = null;
+            try {
+                var dir = Dir.open(get_trace_dir());
+                unowned string? name;
+                while ((name = dir.read_name()) != null) {
+                    if (!name.has_prefix("session-") || !name.has_suffix(".json")) {
+                        continue;
+                    }
+                    if (latest == null || strcmp(name, latest) > 0) {
+                        latest = name;
+                    }
+                }
+            } catch (Error e) {
+                return null;
+            }
+            return latest != null ? Path.build_filename(get_trace_dir(), latest) : null;
+        }
+
+        static string secs(int64 usec)
+        {
+            return "%.3fs".printf(usec / 1000000.0);
+        }
+
+        /**
+         * Print the critical path of a trace, i.e. the chain of nodes that
+         * determined when the session was fully started, followed by the
+         * slowest one-shot autostart items.
+         */
+        public static int summarize(string path)
+        {
+            var events = load(path);
+            if (events == null) {
+                return 1;
+            }
+
+            var nodes = new HashTable<string,TraceEvent>(str_hash, str_equal);
+            TraceEvent? last = null;
+            for (int i = 0; i < events.length; i++) {
+                var ev = events[i];
+                if (ev.category != "node") {
+                    continue;
+                }
+                nodes.insert(ev.name, ev);
+                if (ev.end >= 0 && (last == null || ev.end > last.end)) {
+                    last = ev;
+                }
+            }
+            if (last == null) {
+                stderr.printf("No completed startup nodes in %s\n", path);
+                return 1;
+            }
+
+            stdout.printf("Trace: %s\n", path);
+            stdout.printf("Startup complete after %s\n\n", secs(last.end));
+
+            /* Walk back through whichever dependency became ready last */
+            TraceEvent[] chain = {};
+            for (var ev = last; ev != null; ) {
+                chain += ev;
+                TraceEvent? blocker = null;
+                foreach (var dep in (ev.deps ?? "").split(",")) {
+                    unowned TraceEvent? d = nodes.lookup(dep);
+                    if (d != null && d.end >= 0 && (blocker == null || d.end > blocker.end)) {
+                        blocker = d;
+                    }
+                }
+                ev = blocker;
+            }
+
+            stdout.printf("Critical path:\n");
+            stdout.printf("  %-9s %-9s %-9s %s\n", "start", "ready", "took", "node");
+            for (int i = chain.length - 1; i >= 0; i--) {
+                var ev = chain[i];
+                stdout.printf("  %-9s %-9s %-9s %s%s\n", secs(ev.start), secs(ev.end),
+                    secs(ev.end - ev.start), ev.name, ev.timed_out ? " (timed out)" : "");
+            }
+
+            /* Marks reported by the components themselves */
+            bool header = false;
+            for (int i = 0; i < events.length; i++) {
+                var ev = events[i];
+                if (ev.category != "mark") {
+                    continue;
+                }
+                if (!header) {
+                    stdout.printf("\nMilestones:\n");
+                    header = true;
+                }
+                stdout.printf("  %-9s %s\n", secs(ev.start), ev.name);
+            }
+
+            /* And which processes ran the longest during startup */
+            var spawns = new GenericArray<TraceEvent>();
+            for (int i = 0; i < events.length; i++) {
+                if (events[i].category == "spawn" && events[i].end >= 0) {
+                    spawns.add(events[i]);
+                }
+            }
+            spawns.sort((a, b)=> {
+                var da = a.end - a.start;
+                var db = b.end - b.start;
+                return da > db ? -1 : (da < db ? 1 : 0);
+            });
+            if (spawns.length > 0) {
+                stdout.printf("\nLongest running one-shot processes:\n");
+            }
+            for (int i = 0; i < spawns.length && i < 5; i++) {
+                var ev = spawns[i];
+                stdout.printf("  %-9s %-9s %s (pid %d, status %d)\n", secs(ev.start),
+                    secs(ev.end - ev.start), ev.name, (int)ev.pid, ev.status);
+            }
+            return 0;
+        }
+    }
+
+} // End Budgie namespace
@@ -0,0 +1,245 @@
+/*
+ * Supervisor.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+namespace Budgie
+{
+
+    /* At most RESTART_BUDGET restarts within any RESTART_WINDOW seconds */
+    const int RESTART_BUDGET = 5;
+    const int64 RESTART_WINDOW = 120;
+    /* First restart delay in ms, doubling per consecutive crash up to the max */
+    const uint BACKOFF_BASE = 250;
+    const uint BACKOFF_MAX = 30000;
+    /* Seconds a process must stay up before its crash streak is forgiven */
+    const int64 STABLE_UPTIME = 30;
+    /* Lines of stderr kept per process */
+    const int STDERR_RING_LINES = 100;
+
+    /**
+     * Fixed size buffer holding the most recent lines of output
+     */
+    public class OutputRing {
+
+        string[] lines;
+        int head = 0;
+        int count = 0;
+
+        public OutputRing(int size)
+        {
+            lines = new string[size];
+        }
+
+        public void add(string line)
+        {
+            lines[(head + count) % lines.length] = line;
+            if (count < lines.length) {
+                count++;
+            } else {
+                head = (head + 1) % lines.length;
+            }
+        }
+
+        /**
+         * All retained lines, oldest first
+         */
+        public string to_string()
+        {
+            var sb = new StringBuilder();
+            for (int i = 0; i < count; i++) {
+                sb.append(lines[(head + i) % lines.length]);
+                sb.append_c('\n');
+            }
+            return sb.str;
+        }
+    }
+
+    /**
+     * Container class to monitor processes, how many times they have been
+     * launched, and how often they've crashed recently.
+     */
+    protected class  WatchedProcess {
+
+        /** Current PID of the process */
+        public Pid pid { public get; public set; }
+
+        /** Number of times this process has been launched */
+        public int n_times { public get; public set; }
+
+         /** Command line for the process */
+        public string cmd_line { public get; public set; }
+
+        /** Whether the process is currently alive */
+        public bool running = false;
+        /** Crashes since the process was last up for STABLE_UPTIME */
+        public int failures = 0;
+        /** No longer restarted, its restart budget was exceeded */
+        public bool gave_up = false;
+        public int last_status = 0;
+        /** Real time of the last exit, 0 if never exited */
+        public int64 last_exit = 0;
+        /** Monotonic time of the last launch */
+        public int64 started = 0;
+        /** Pending delayed restart */
+        public uint restart_id = 0;
+        public uint next_restart_delay = 0;
+
+        /** Monotonic times of recent restarts, oldest first */
+        Queue<int64?> restarts = new Queue<int64?>();
+
+        public OutputRing stderr_ring = new OutputRing(STDERR_RING_LINES);
+
+        /**
+         * Number of restarts within the last RESTART_WINDOW seconds
+         */
+        public uint recent_restarts()
+        {
+            var cutoff = get_monotonic_time() - RESTART_WINDOW * 1000000;
+            while (!restarts.is_empty() && restarts.peek_head() < cutoff) {
+                restarts.pop_head();
+            }
+            return restarts.length;
+        }
+
+        /**
+         * Record a restart if the budget allows for one
+         *
+         * @return false if the process should be given up on
+         */
+        public bool take_restart()
+        {
+            if (recent_restarts() >= RESTART_BUDGET) {
+                return false;
+            }
+            restarts.push_tail(get_monotonic_time());
+            return true;
+        }
+
+        /**
+         * Delay before the next restart, exponential in the crash streak
+         */
+        public uint backoff_delay()
+        {
+            uint delay = BACKOFF_BASE;
+            for (int i = 1; i < failures && delay < BACKOFF_MAX; i++) {
+                delay *= 2;
+            }
+            return uint.min(delay, BACKOFF_MAX);
+        }
+
+        /**
+         * Drain the child's output. stderr is kept in the ring buffer and
+         * both are passed on to our own, so nothing blocks on a full pipe.
+         * The watches go away by themselves once the child closes its end.
+         */
+        public void watch_output(int fdout, int fderr)
+        {
+            watch_fd(fdout, false);
+            watch_fd(fderr, true);
+        }
+
+        void watch_fd(int fd, bool is_stderr)
+        {
+            var channel = new IOChannel.unix_new(fd);
+            channel.set_close_on_unref(true);
+            try {
+                /* Raw bytes, we don't want to stop reading on bad UTF-8 */
+                channel.set_encoding(null);
+                channel.set_flags(channel.get_flags() | IOFlags.NONBLOCK);
+            } catch (IOChannelError e) { }
+
+            var name = Path.get_basename(cmd_line.split(" ")[0]);
+            channel.add_watch(IOCondition.IN | IOCondition.HUP | IOCondition.ERR, (source, cond)=> {
+                string? line = null;
+                size_t len;
+                size_t term;
+                try {
+                    while (source.read_line(out line, out len, out term) == IOStatus.NORMAL) {
+                        line = line.substring(0, (long)term);
+                        if (is_stderr) {
+                            stderr_ring.add(line.validate() ? line : line.escape(""));
+                            stderr.printf("[%s] %s\n", name, line);
+                        } else {
+                            stdout.printf("[%s] %s\n", name, line);
+                        }
+                    }
+                } catch (Error e) {
+                    return false;
+                }
+                return (cond & (IOCondition.HUP | IOCondition.ERR)) == 0;
+            });
+        }
+    }
+
+    /**
+     * Restart statistics for the supervised processes, exported on the
+     * session application's object path.
+     */
+    [DBus (name = "com.evolve_os.BudgieSession.Supervisor")]
+    public class SupervisorStats : Object {
+
+        unowned Gee.HashMap<string,WatchedProcess?> process_map;
+
+        internal SupervisorStats(Gee.HashMap<string,WatchedProcess?> process_map)
+        {
+            this.process_map = process_map;
+        }
+
+        /**
+         * Command lines of all supervised processes
+         */
+        public string[] list_processes()
+        {
+            string[] ret = {};
+            foreach (var key in process_map.keys) {
+                ret += key;
+            }
+            return ret;
+        }
+
+        /**
+         * Launch and restart statistics for a supervised process
+         */
+        public HashTable<string,Variant> get_stats(string cmd_line) throws IOError
+        {
+            var p = lookup(cmd_line);
+            var ret = new HashTable<string,Variant>(str_hash, str_equal);
+            ret.insert("pid", new Variant.int32(p.running ? (int32)p.pid : 0));
+            ret.insert("running", new Variant.boolean(p.running));
+            ret.insert("launches", new Variant.int32(p.n_times));
+            ret.insert("recent-restarts", new Variant.uint32(p.recent_restarts()));
+            ret.insert("restart-budget", new Variant.int32(RESTART_BUDGET));
+            ret.insert("restart-window", new Variant.int64(RESTART_WINDOW));
+            ret.insert("failures", new Variant.int32(p.failures));
+            ret.insert("gave-up", new Variant.boolean(p.gave_up));
+            ret.insert("last-status", new Variant.int32(p.last_status));
+            ret.insert("last-exit", new Variant.int64(p.last_exit / 1000000));
+            ret.insert("restart-pending-ms", new Variant.uint32(p.restart_id > 0 ? p.next_restart_delay : 0));
+            return ret;
+        }
+
+        /**
+         * The most recent stderr output of a supervised process
+         */
+        public string get_stderr(string cmd_line) throws IOError
+        {
+            return lookup(cmd_line).stderr_ring.to_string();
+        }
+
+        WatchedProcess lookup(string cmd_line) throws IOError
+        {
+            if (!process_map.has_key(cmd_line)) {
+                throw new IOError.NOT_FOUND("Not a supervised process: %s", cmd_line);
+            }
+            return process_map[cmd_line];
+        }
+    }
+
+} // End Budgie namespace
@@ -21,6 +21,7 @@ static void budgie_session_dialog_dispose(GObject *object);
 
 static void clicked(GtkWidget *button, gpointer userdata);
 static void init_styles(BudgieSessionDialog *self);
+static void on_proxy_ready(GObject *source, GAsyncResult *res, gpointer userdata);
 
 typedef enum {
         SD_CHALLENGE,
@@ -57,70 +58,22 @@ static void budgie_session_dialog_init(BudgieSessionDialog *self)
         GtkWidget *label;
         autofree gchar *txt = NULL;
         const gchar *name;
-        GError *error = NULL;
         GtkStyleContext *style;
-        gboolean can_reboot = FALSE;
-        gboolean can_poweroff = FALSE;
-        gboolean can_suspend = FALSE;
-        gboolean can_systemd = TRUE;
-        autofree gchar *result = NULL;
         GtkWidget *header = NULL;
-        SdResponse response;
 
         init_styles(self);
 
-        /* Let's set up some systemd logic eh? */
-        self->proxy = sd_login_manager_proxy_new_for_bus_sync(G_BUS_TYPE_SYSTEM,
-                G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
+        /* Let's set up some systemd logic eh? Asynchronously, so we show up
+         * straight away and enable the buttons as logind answers. We don't
+         * use any properties, so don't wait for them either. */
+        self->cancellable = g_cancellable_new();
+        sd_login_manager_proxy_new_for_bus(G_BUS_TYPE_SYSTEM,
+                G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS,
                 "org.freedesktop.login1",
                 "/org/freedesktop/login1",
-                NULL,
-                &error);
-        if (error) {
-                g_error_free(error);
-                can_systemd = FALSE;
-        } else {
-                can_systemd = TRUE;
-        }
-
-        if (can_systemd) {
-                /* Can we reboot? */
-                if (!sd_login_manager_call_can_reboot_sync(self->proxy,
-                        &result, NULL, NULL)) {
-                        can_reboot = FALSE;
-                } else {
-                        response = get_response(result);
-                        if (response == SD_YES || response == SD_CHALLENGE) {
-                                can_reboot = TRUE;
-                        }
-                        g_free(result);
-                        result = NULL;
-                }
-                /* Can we suspend? */
-                if (!sd_login_manager_call_can_suspend_sync(self->proxy,
-                        &result, NULL, NULL)) {
-                        can_suspend = FALSE;
-                } else {
-                        response = get_response(result);
-                        if (response == SD_YES || response == SD_CHALLENGE) {
-                                can_suspend = TRUE;
-                        }
-                        g_free(result);
-                        result = NULL;
-                }
-                /* Can we shutdown? */
-                if (!sd_login_manager_call_can_power_off_sync(self->proxy,
-                        &result, NULL, NULL)) {
-                        can_poweroff = FALSE;
-                } else {
-                        response = get_response(result);
-                        if (response == SD_YES || response == SD_CHALLENGE) {
-                                can_poweroff = TRUE;
-                        }
-                        g_free(result);
-                        result = NULL;
-                }
-        }
+                self->cancellable,
+                on_proxy_ready,
+                self);
 
         gtk_window_set_position(GTK_WINDOW(self), GTK_WIN_POS_CENTER_ALWAYS);
         gtk_window_set_skip_taskbar_hint(GTK_WINDOW(self), TRUE);
@@ -168,27 +121,27 @@ static void budgie_session_dialog_init(BudgieSessionDialog *self)
         g_signal_connect(button, "clicked", G_CALLBACK(clicked), self);
         gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
         gtk_box_pack_start(GTK_BOX(layout), button, FALSE, FALSE, 0);
-        if (!can_suspend) {
-                gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
-        }
+        /* Pending until logind tells us otherwise */
+        gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
+        self->suspend_button = button;
 
         button = gtk_button_new_with_label("Restart");
         g_object_set_data(G_OBJECT(button), "action", "reboot");
         g_signal_connect(button, "clicked", G_CALLBACK(clicked), self);
         gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
         gtk_box_pack_start(GTK_BOX(layout), button, FALSE, FALSE, 0);
-        if (!can_reboot) {
-                gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
-        }
+        /* Pending until logind tells us otherwise */
+        gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
+        self->reboot_button = button;
 
         button = gtk_button_new_with_label("Shut Down");
         g_object_set_data(G_OBJECT(button), "action", "poweroff");
         g_signal_connect(button, "clicked", G_CALLBACK(clicked), self);
         gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
         gtk_box_pack_start(GTK_BOX(layout), button, FALSE, FALSE, 0);
-        if (!can_poweroff) {
-                gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
-        }
+        /* Pending until logind tells us otherwise */
+        gtk_widget_set_sensitive(GTK_WIDGET(button), FALSE);
+        self->poweroff_button = button;
 
         button = gtk_button_new_with_label("Cancel");
         g_object_set_data(G_OBJECT(button), "action", "cancel");
@@ -213,6 +166,12 @@ static void budgie_session_dialog_dispose(GObject *object)
         BudgieSessionDialog *self;
 
         self = BUDGIE_SESSION_DIALOG(object);
+        /* Outstanding calls must not call back into us */
+        if (self->cancellable) {
+                g_cancellable_cancel(self->cancellable);
+                g_object_unref(self->cancellable);
+                self->cancellable = NULL;
+        }
         if (self->proxy) {
                 g_object_unref(self->proxy);
                 self->proxy = NULL;
@@ -221,6 +180,96 @@ static void budgie_session_dialog_dispose(GObject *object)
         G_OBJECT_CLASS (budgie_session_dialog_parent_class)->dispose (object);
 }
 
+/**
+ * Enable a button once logind has answered its capability query
+ */
+static void update_button(GtkWidget *button, gboolean ok, gchar *result)
+{
+        SdResponse response;
+
+        if (!ok) {
+                return;
+        }
+        response = get_response(result);
+        if (response == SD_YES || response == SD_CHALLENGE) {
+                gtk_widget_set_sensitive(button, TRUE);
+        }
+        g_free(result);
+}
+
+static void on_can_suspend(GObject *source, GAsyncResult *res, gpointer userdata)
+{
+        gchar *result = NULL;
+        GError *error = NULL;
+        gboolean ok;
+
+        ok = sd_login_manager_call_can_suspend_finish(SD_LOGIN_MANAGER(source), &result, res, &error);
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                /* Dialog is gone */
+                g_error_free(error);
+                return;
+        }
+        if (error) {
+                g_error_free(error);
+        }
+        update_button(BUDGIE_SESSION_DIALOG(userdata)->suspend_button, ok, result);
+}
+
+static void on_can_reboot(GObject *source, GAsyncResult *res, gpointer userdata)
+{
+        gchar *result = NULL;
+        GError *error = NULL;
+        gboolean ok;
+
+        ok = sd_login_manager_call_can_reboot_finish(SD_LOGIN_MANAGER(source), &result, res, &error);
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free(error);
+                return;
+        }
+        if (error) {
+                g_error_free(error);
+        }
+        update_button(BUDGIE_SESSION_DIALOG(userdata)->reboot_button, ok, result);
+}
+
+static void on_can_power_off(GObject *source, GAsyncResult *res, gpointer userdata)
+{
+        gchar *result = NULL;
+        GError *error = NULL;
+        gboolean ok;
+
+        ok = sd_login_manager_call_can_power_off_finish(SD_LOGIN_MANAGER(source), &result, res, &error);
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free(error);
+                return;
+        }
+        if (error) {
+                g_error_free(error);
+        }
+        update_button(BUDGIE_SESSION_DIALOG(userdata)->poweroff_button, ok, result);
+}
+
+static void on_proxy_ready(GObject *source, GAsyncResult *res, gpointer userdata)
+{
+        BudgieSessionDialog *self;
+        SdLoginManager *proxy;
+        GError *error = NULL;
+
+        proxy = sd_login_manager_proxy_new_for_bus_finish(res, &error);
+        if (!proxy) {
+                /* Cancelled, or no logind, in which case we can only log out */
+                g_error_free(error);
+                return;
+        }
+        self = BUDGIE_SESSION_DIALOG(userdata);
+        self->proxy = proxy;
+
+        /* Ask everything at once, the buttons enable as the answers arrive */
+        sd_login_manager_call_can_suspend(self->proxy, self->cancellable, on_can_suspend, self);
+        sd_login_manager_call_can_reboot(self->proxy, self->cancellable, on_can_reboot, self);
+        sd_login_manager_call_can_power_off(self->proxy, self->cancellable, on_can_power_off, self);
+}
+
 /* Utility; return a new BudgieSessionDialog */
 BudgieSessionDialog *budgie_session_dialog_new(void)
 {
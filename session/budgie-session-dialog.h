@@ -42,6 +42,10 @@ typedef struct _BudgieSessionDialogClass   BudgieSessionDialogClass;
 struct _BudgieSessionDialog {
         GtkWindow parent;
         SdLoginManager *proxy;
+        GCancellable *cancellable;
+        GtkWidget *suspend_button;
+        GtkWidget *reboot_button;
+        GtkWidget *poweroff_button;
 };
 
 /* BudgieSessionDialog class definition */
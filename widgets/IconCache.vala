@@ -0,0 +1,389 @@
+/*
+ * IconCache.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+namespace Budgie
+{
+
+/**
+ * Default memory budget for the icon cache, in bytes
+ */
+public const uint64 ICON_CACHE_DEFAULT_BUDGET = 8 * 1024 * 1024;
+
+/* Per-image state for images kept up to date by the cache */
+const string ICON_CACHE_GICON_KEY = "budgie-icon-cache-gicon";
+const string ICON_CACHE_SIZE_KEY = "budgie-icon-cache-size";
+const string ICON_CACHE_LIVE_KEY = "budgie-icon-cache-live";
+const string ICON_CACHE_TRACKED_KEY = "budgie-icon-cache-tracked";
+
+/**
+ * Single rasterized icon, linked into the LRU list
+ */
+class IconCacheEntry
+{
+    public string key;
+    public Gdk.Pixbuf pixbuf;
+    /* Keeps pixbuf sources (i.e. window icons) alive, so keys stay unique */
+    public Object? source;
+    public uint64 bytes;
+
+    public IconCacheEntry? next = null;
+    public unowned IconCacheEntry? prev = null;
+
+    public IconCacheEntry(string key, Gdk.Pixbuf pixbuf, Object? source)
+    {
+        this.key = key;
+        this.pixbuf = pixbuf;
+        this.source = source;
+        bytes = (uint64)pixbuf.rowstride * pixbuf.height;
+        var src = source as Gdk.Pixbuf;
+        if (src != null && src != pixbuf) {
+            bytes += (uint64)src.rowstride * src.height;
+        }
+    }
+}
+
+/**
+ * Process-wide cache of rasterized icons, keyed by (GIcon or pixbuf
+ * source, size, scale).
+ *
+ * Entries are evicted in least-recently-used order once the byte budget
+ * is exceeded, and the whole cache is dropped when the icon theme changes.
+ * Images set through set_image_from_gicon() are re-rendered when the theme
+ * or their scale factor changes.
+ */
+public class IconCache : Object
+{
+
+    private static IconCache? instance = null;
+
+    private HashTable<string,IconCacheEntry> entries;
+    /* Most recently used first */
+    private IconCacheEntry? head = null;
+    private unowned IconCacheEntry? tail = null;
+
+    private uint64 _budget = ICON_CACHE_DEFAULT_BUDGET;
+
+    /**
+     * Maximum number of bytes of pixel data to retain
+     */
+    public uint64 budget {
+        public get {
+            return _budget;
+        }
+        public set {
+            _budget = value;
+            evict();
+        }
+    }
+
+    /**
+     * Number of bytes of pixel data currently retained
+     */
+    public uint64 size_bytes { public get; private set; default = 0; }
+
+    public uint hits { public get; private set; default = 0; }
+    public uint misses { public get; private set; default = 0; }
+    public uint evictions { public get; private set; default = 0; }
+
+    /**
+     * Emitted after the cache was dropped for a new icon theme
+     */
+    public signal void invalidated();
+
+    /**
+     * Obtain the shared IconCache for this process
+     */
+    public static unowned IconCache get_default()
+    {
+        if (instance == null) {
+            instance = new IconCache();
+        }
+        return instance;
+    }
+
+    private IconCache()
+    {
+        entries = new HashTable<string,IconCacheEntry>(str_hash, str_equal);
+        Gtk.IconTheme.get_default().changed.connect(()=> {
+            clear();
+            invalidated();
+        });
+    }
+
+    /**
+     * Drop every cached icon
+     */
+    public void clear()
+    {
+        entries.remove_all();
+        /* Unlink iteratively, avoiding a deep recursive unref chain */
+        while (head != null) {
+            head = head.next;
+        }
+        tail = null;
+        size_bytes = 0;
+    }
+
+    /**
+     * Load a GIcon from the current icon theme at the given size
+     *
+     * @return a pixbuf of size * scale pixels, or null if it can't be loaded
+     */
+    public Gdk.Pixbuf? load_gicon(Icon icon, int size, int scale = 1)
+    {
+        var name = icon.to_string();
+        if (name == null) {
+            /* Not serializable, so no sane key. Don't cache it. */
+            misses++;
+            return render_gicon(icon, size, scale);
+        }
+        var key = "gicon:%s:%d@%d".printf(name, size, scale);
+        var pixbuf = lookup(key);
+        if (pixbuf != null) {
+            return pixbuf;
+        }
+        pixbuf = render_gicon(icon, size, scale);
+        if (pixbuf != null) {
+            insert(key, pixbuf, null);
+        }
+        return pixbuf;
+    }
+
+    /**
+     * Scale an existing pixbuf (i.e. a window icon) to the given size
+     *
+     * @return a pixbuf of size * scale pixels
+     */
+    public Gdk.Pixbuf load_pixbuf(Gdk.Pixbuf source, int size, int scale = 1)
+    {
+        var key = "pixbuf:%p:%d@%d".printf((void*)source, size, scale);
+        var pixbuf = lookup(key);
+        if (pixbuf != null) {
+            return pixbuf;
+        }
+        var px = size * scale;
+        if (source.width == px && source.height == px) {
+            pixbuf = source;
+        } else {
+            pixbuf = source.scale_simple(px, px, Gdk.InterpType.BILINEAR);
+        }
+        insert(key, pixbuf, source);
+        return pixbuf;
+    }
+
+    /**
+     * Load an image file (i.e. album art) to fit within the given size
+     *
+     * @return a pixbuf, or null if the file can't be loaded
+     */
+    public Gdk.Pixbuf? load_file(string path, int size, int scale = 1)
+    {
+        uint64 mtime = 0;
+        try {
+            var info = File.new_for_path(path).query_info(FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE, null);
+            mtime = info.get_attribute_uint64(FileAttribute.TIME_MODIFIED);
+        } catch (Error e) {
+            return null;
+        }
+        /* Players tend to rewrite the same file, so the mtime is part of the key */
+        var key = "file:%s:%s:%d@%d".printf(path, mtime.to_string(), size, scale);
+        var pixbuf = lookup(key);
+        if (pixbuf != null) {
+            return pixbuf;
+        }
+        try {
+            pixbuf = new Gdk.Pixbuf.from_file_at_size(path, size * scale, size * scale);
+        } catch (Error e) {
+            return null;
+        }
+        insert(key, pixbuf, null);
+        return pixbuf;
+    }
+
+    /**
+     * Set an image from a cached rendering of the given GIcon. The image
+     * follows icon theme and scale factor changes from then on, until it's
+     * set from a pixbuf instead.
+     */
+    public static void set_image_from_gicon(Gtk.Image image, Icon? icon, int size)
+    {
+        image.set_data<Icon?>(ICON_CACHE_GICON_KEY, icon);
+        image.set_data<int>(ICON_CACHE_SIZE_KEY, size);
+        image.set_data<bool>(ICON_CACHE_LIVE_KEY, true);
+        track_image(image);
+        update_image(image);
+    }
+
+    /**
+     * Set an image from a pixbuf rendered for the given scale factor
+     */
+    public static void set_image_from_pixbuf(Gtk.Image image, Gdk.Pixbuf pixbuf, int scale)
+    {
+        image.set_data<bool>(ICON_CACHE_LIVE_KEY, false);
+        apply_pixbuf(image, pixbuf, scale);
+    }
+
+    private static void track_image(Gtk.Image image)
+    {
+        if (image.get_data<bool>(ICON_CACHE_TRACKED_KEY)) {
+            return;
+        }
+        image.set_data<bool>(ICON_CACHE_TRACKED_KEY, true);
+
+        unowned Gtk.Image img = image;
+        var id = get_default().invalidated.connect(()=> {
+            update_image(img);
+        });
+        image.notify["scale-factor"].connect(()=> {
+            update_image(img);
+        });
+        image.destroy.connect(()=> {
+            get_default().disconnect(id);
+        });
+    }
+
+    private static void update_image(Gtk.Image image)
+    {
+        if (!image.get_data<bool>(ICON_CACHE_LIVE_KEY)) {
+            return;
+        }
+        unowned Icon? icon = image.get_data<Icon?>(ICON_CACHE_GICON_KEY);
+        var size = image.get_data<int>(ICON_CACHE_SIZE_KEY);
+
+        image.pixel_size = size;
+        if (icon == null) {
+            image.clear();
+            return;
+        }
+        if (is_symbolic(icon)) {
+            /* GTK recolours these to match the widget's style */
+            image.set_from_gicon(icon, Gtk.IconSize.INVALID);
+            return;
+        }
+        var scale = image.get_scale_factor();
+        var pixbuf = get_default().load_gicon(icon, size, scale);
+        if (pixbuf == null) {
+            /* Let GTK fall back to its missing image */
+            image.set_from_gicon(icon, Gtk.IconSize.INVALID);
+            return;
+        }
+        apply_pixbuf(image, pixbuf, scale);
+    }
+
+    private static void apply_pixbuf(Gtk.Image image, Gdk.Pixbuf pixbuf, int scale)
+    {
+        if (scale <= 1) {
+            image.set_from_pixbuf(pixbuf);
+            return;
+        }
+        var surface = Gdk.cairo_surface_create_from_pixbuf(pixbuf, scale, image.get_window());
+        image.set_from_surface(surface);
+    }
+
+    private static bool is_symbolic(Icon icon)
+    {
+        var themed = icon as ThemedIcon;
+        if (themed == null) {
+            return false;
+        }
+        foreach (var name in themed.get_names()) {
+            if (name.has_suffix("-symbolic")) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    private Gdk.Pixbuf? render_gicon(Icon icon, int size, int scale)
+    {
+        var theme = Gtk.IconTheme.get_default();
+        var info = theme.lookup_by_gicon_for_scale(icon, size, scale, Gtk.IconLookupFlags.FORCE_SIZE);
+        if (info == null) {
+            return null;
+        }
+        try {
+            return info.load_icon();
+        } catch (Error e) {
+            return null;
+        }
+    }
+
+    private Gdk.Pixbuf? lookup(string key)
+    {
+        unowned IconCacheEntry? entry = entries.lookup(key);
+        if (entry == null) {
+            misses++;
+            return null;
+        }
+        hits++;
+        if (entry != head) {
+            unlink(entry);
+            push_head(entry);
+        }
+        return entry.pixbuf;
+    }
+
+    private void insert(string key, Gdk.Pixbuf pixbuf, Object? source)
+    {
+        var entry = new IconCacheEntry(key, pixbuf, source);
+        if (entry.bytes > _budget) {
+            /* Would only evict everything else and then itself */
+            return;
+        }
+        push_head(entry);
+        entries.insert(key, entry);
+        size_bytes += entry.bytes;
+        evict();
+    }
+
+    private void push_head(IconCacheEntry entry)
+    {
+        entry.prev = null;
+        entry.next = head;
+        if (head != null) {
+            head.prev = entry;
+        } else {
+            tail = entry;
+        }
+        head = entry;
+    }
+
+    private void unlink(IconCacheEntry entry)
+    {
+        /* Keep the entry alive while we juggle the owned links */
+        IconCacheEntry e = entry;
+        if (e.prev != null) {
+            e.prev.next = e.next;
+        } else {
+            head = e.next;
+        }
+        if (e.next != null) {
+            e.next.prev = e.prev;
+        } else {
+            tail = e.prev;
+        }
+        e.next = null;
+        e.prev = null;
+    }
+
+    private void evict()
+    {
+        while (size_bytes > _budget && tail != null) {
+            IconCacheEntry victim = tail;
+            unlink(victim);
+            size_bytes -= victim.bytes;
+            entries.remove(victim.key);
+            evictions++;
+        }
+    }
+}
+
+} // End Budgie namespace
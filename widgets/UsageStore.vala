@@ -0,0 +1,321 @@
+/*
+ * UsageStore.vala
+ *
+ * Copyright 2014 Ikey Doherty <ikey.doherty@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+namespace Budgie
+{
+
+/**
+ * A launch loses half of its weight over this many seconds
+ */
+public const int64 USAGE_HALF_LIFE = 14 * 24 * 60 * 60;
+
+/**
+ * Seconds to wait for more launches before writing the store out
+ */
+public const uint USAGE_SAVE_DELAY = 5;
+
+/**
+ * Records decayed below this weight are dropped when saving
+ */
+const double USAGE_PRUNE_SCORE = 0.05;
+
+const string USAGE_FILE_HEADER = "# budgie usage v1";
+
+/**
+ * Decayed score for one application, as of stamp
+ */
+class UsageRecord
+{
+    public double score;
+    /* Unix time of the last launch */
+    public int64 stamp;
+
+    public UsageRecord(double score, int64 stamp)
+    {
+        this.score = score;
+        this.stamp = stamp;
+    }
+
+    public double score_at(int64 now)
+    {
+        if (now <= stamp) {
+            return score;
+        }
+        return score * Math.pow(2.0, -(double)(now - stamp) / USAGE_HALF_LIFE);
+    }
+}
+
+/**
+ * Frecency store for launched applications, shared between the menu and
+ * the run dialog.
+ *
+ * Scores live in memory and decay over time, so recent launches outweigh
+ * old habits. Changes are written out asynchronously in batches to a small
+ * text file, and changes made by other processes are merged back in.
+ * Keys are desktop file paths, as per DesktopAppInfo.get_filename().
+ */
+public class UsageStore : Object
+{
+
+    private static UsageStore? instance = null;
+
+    private HashTable<string,UsageRecord> records;
+    private File file;
+    private FileMonitor? monitor = null;
+    /* Etag of our own last write, so we don't reload it */
+    private string? own_etag = null;
+    private uint save_id = 0;
+    private bool saving = false;
+    private bool dirty = false;
+
+    /**
+     * Whether a store existed on disk when we were loaded
+     */
+    public bool exists { public get; private set; default = false; }
+
+    /**
+     * Emitted when scores change, from this process or another
+     */
+    public signal void changed();
+
+    /**
+     * Obtain the shared UsageStore for this process, loading it if needed.
+     * This does not depend on any widgets, so call it early to have scores
+     * available for the initial sort.
+     */
+    public static unowned UsageStore get_default()
+    {
+        if (instance == null) {
+            instance = new UsageStore();
+        }
+        return instance;
+    }
+
+    private UsageStore()
+    {
+        records = new HashTable<string,UsageRecord>(str_hash, str_equal);
+        var dir = Path.build_filename(Environment.get_user_data_dir(), "budgie-desktop");
+        file = File.new_for_path(Path.build_filename(dir, "app-usage"));
+
+        exists = load(false);
+        try {
+            monitor = file.monitor_file(FileMonitorFlags.NONE, null);
+            monitor.changed.connect(on_file_changed);
+        } catch (Error e) {
+            warning("Unable to monitor %s: %s", file.get_path(), e.message);
+        }
+    }
+
+    /**
+     * Current (decayed) score for the given desktop file, 0 if never used
+     */
+    public double get_score(string? key)
+    {
+        if (key == null) {
+            return 0.0;
+        }
+        unowned UsageRecord? record = records.lookup(key);
+        if (record == null) {
+            return 0.0;
+        }
+        return record.score_at(now());
+    }
+
+    /**
+     * Count a launch of the given desktop file
+     */
+    public void record_launch(string? key)
+    {
+        if (key == null) {
+            return;
+        }
+        var now = now();
+        unowned UsageRecord? record = records.lookup(key);
+        if (record == null) {
+            records.insert(key, new UsageRecord(1.0, now));
+        } else {
+            record.score = record.score_at(now) + 1.0;
+            record.stamp = now;
+        }
+        queue_save();
+        changed();
+    }
+
+    /**
+     * Seed a score from another source (i.e. legacy launch counters),
+     * without overriding anything already known.
+     */
+    public void import_score(string key, double score)
+    {
+        if (records.contains(key) || score <= 0.0) {
+            return;
+        }
+        records.insert(key, new UsageRecord(score, now()));
+        queue_save();
+    }
+
+    /**
+     * Write any pending changes immediately, i.e. before the process exits
+     */
+    public void flush()
+    {
+        if (save_id > 0) {
+            Source.remove(save_id);
+            save_id = 0;
+        }
+        if (!dirty) {
+            return;
+        }
+        try {
+            ensure_dir();
+            string etag;
+            file.replace_contents(serialize().data, null, false, FileCreateFlags.REPLACE_DESTINATION, out etag, null);
+            own_etag = etag;
+            dirty = false;
+            exists = true;
+        } catch (Error e) {
+            warning("Unable to save %s: %s", file.get_path(), e.message);
+        }
+    }
+
+    private static int64 now()
+    {
+        return get_real_time() / 1000000;
+    }
+
+    private void queue_save()
+    {
+        dirty = true;
+        if (save_id > 0) {
+            return;
+        }
+        save_id = Timeout.add_seconds(USAGE_SAVE_DELAY, ()=> {
+            save_id = 0;
+            save_async.begin();
+            return false;
+        });
+    }
+
+    private async void save_async()
+    {
+        if (saving) {
+            /* The running write re-queues once it lands */
+            return;
+        }
+        saving = true;
+        dirty = false;
+        /* Owned by the coroutine until the write completes */
+        var data = serialize();
+        try {
+            ensure_dir();
+            string etag;
+            yield file.replace_contents_async(data.data, null, false, FileCreateFlags.REPLACE_DESTINATION, null, out etag);
+            own_etag = etag;
+            exists = true;
+        } catch (Error e) {
+            warning("Unable to save %s: %s", file.get_path(), e.message);
+        }
+        saving = false;
+        if (dirty && save_id == 0) {
+            dirty = false;
+            queue_save();
+        }
+    }
+
+    private void ensure_dir()
+    {
+        var parent = file.get_parent();
+        if (!parent.query_exists()) {
+            DirUtils.create_with_parents(parent.get_path(), 00755);
+        }
+    }
+
+    /**
+     * One record per line: score, stamp and key, tab separated.
+     */
+    private string serialize()
+    {
+        var now = now();
+        var sb = new StringBuilder(USAGE_FILE_HEADER);
+        sb.append_c('\n');
+        var iter = HashTableIter<string,UsageRecord>(records);
+        unowned string key;
+        unowned UsageRecord record;
+        while (iter.next(out key, out record)) {
+            if (record.score_at(now) < USAGE_PRUNE_SCORE) {
+                iter.remove();
+                continue;
+            }
+            sb.append_printf("%s\t%s\t%s\n", record.score.to_string(), record.stamp.to_string(), key);
+        }
+        return sb.str;
+    }
+
+    /**
+     * Load the file from disk.
+     *
+     * @param merge Keep in-memory records that are newer than those on disk
+     * @return true if the file could be read
+     */
+    private bool load(bool merge)
+    {
+        uint8[] contents;
+        try {
+            file.load_contents(null, out contents, null);
+        } catch (Error e) {
+            return false;
+        }
+        var lines = ((string)contents).split("\n");
+        if (lines.length == 0 || lines[0] != USAGE_FILE_HEADER) {
+            warning("Ignoring unknown usage store format in %s", file.get_path());
+            return false;
+        }
+
+        for (int i = 1; i < lines.length; i++) {
+            var fields = lines[i].split("\t", 3);
+            if (fields.length != 3) {
+                continue;
+            }
+            var score = double.parse(fields[0]);
+            var stamp = int64.parse(fields[1]);
+            unowned UsageRecord? record = records.lookup(fields[2]);
+            if (record != null && merge && record.stamp >= stamp) {
+                continue;
+            }
+            records.insert(fields[2], new UsageRecord(score, stamp));
+        }
+        return true;
+    }
+
+    private void on_file_changed(File f, File? other, FileMonitorEvent event)
+    {
+        if (event != FileMonitorEvent.CHANGES_DONE_HINT && event != FileMonitorEvent.CREATED) {
+            return;
+        }
+        if (saving) {
+            return;
+        }
+        /* Our own save landing, nothing new for anyone */
+        try {
+            var info = file.query_info(FileAttribute.ETAG_VALUE, FileQueryInfoFlags.NONE, null);
+            if (info.get_etag() == own_etag) {
+                return;
+            }
+        } catch (Error e) {
+            return;
+        }
+        if (load(true)) {
+            changed();
+        }
+    }
+}
+
+} // End Budgie namespace
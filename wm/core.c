@@ -26,6 +26,18 @@
 #include "background.h"
 #define SHOW_TIMEOUT 1000
 
+/* The run dialog stays resident, and is toggled via its GApplication action */
+#define RUN_DIALOG_BINARY "budgie-run-dialog"
+#define RUN_DIALOG_BUS_NAME "com.evolve_os.BudgieRunDialog"
+#define RUN_DIALOG_OBJECT_PATH "/com/evolve_os/BudgieRunDialog"
+/* Owned once we're up, budgie-session waits on this before starting the panel */
+#define BUDGIE_WM_BUS_NAME "com.evolve_os.BudgieWM"
+/* budgie-session collects startup milestones via its "trace-mark" action */
+#define SESSION_BUS_NAME "com.evolve_os.BudgieSession"
+#define SESSION_OBJECT_PATH "/com/evolve_os/BudgieSession"
+/* Seconds after startup to preload it, staying out of the login rush */
+#define RUN_DIALOG_PRELOAD_DELAY 10
+
 
 G_DEFINE_TYPE_WITH_PRIVATE(BudgieWM, budgie_wm, META_TYPE_PLUGIN)
 
@@ -47,6 +59,9 @@ static void budgie_launch_rundialog(MetaDisplay *display,
                                      MetaKeyBinding *binding,
                                      gpointer user_data);
 
+static gboolean budgie_preload_rundialog(gpointer user_data);
+static void on_session_bus(GObject *source, GAsyncResult *res, gpointer user_data);
+
 static const MetaPluginInfo *budgie_plugin_info(MetaPlugin *plugin);
 
 static void budgie_wm_class_init(BudgieWMClass *klass)
@@ -90,8 +105,14 @@ static void budgie_wm_init(BudgieWM *self)
 
 static void budgie_wm_dispose(GObject *object)
 {
+        BudgieWM *self = BUDGIE_WM(object);
+
         /* Any stray lists the tab module might have */
         tabs_clean();
+        /* Put windows still sliding back in place, frees switch_actors */
+        kill_switch_workspace(META_PLUGIN(object));
+        budgie_animation_shutdown();
+        g_clear_object(&self->priv->session_bus);
         G_OBJECT_CLASS(budgie_wm_parent_class)->dispose(object);
 }
 
@@ -101,6 +122,9 @@ static void budgie_wm_start(MetaPlugin *plugin)
         MetaScreen *screen = meta_plugin_get_screen(plugin);
         ClutterActor* actors[2];
 
+        /* Effect durations, and quality tracking */
+        budgie_animation_init(meta_get_stage_for_screen(screen));
+
         /* Init background */
         self->priv->background_group = meta_background_group_new();
         clutter_actor_insert_child_below(meta_get_window_group_for_screen(screen),
@@ -135,11 +159,53 @@ static void budgie_wm_start(MetaPlugin *plugin)
         meta_keybindings_set_custom_handler(BUDGIE_KEYBINDING_MAIN_MENU,
                 budgie_launch_menu, NULL, NULL);
         meta_keybindings_set_custom_handler(BUDGIE_KEYBINDING_RUN_DIALOG,
-                budgie_launch_rundialog, NULL, NULL);
+                budgie_launch_rundialog, self, NULL);
         meta_keybindings_set_custom_handler("switch-windows",
                 (MetaKeyHandlerFunc)switch_windows, self, NULL);
         meta_keybindings_set_custom_handler("switch-applications",
                 (MetaKeyHandlerFunc)switch_windows, self, NULL);
+
+        /* Talk to the resident run dialog, and get it started in good time */
+        g_bus_get(G_BUS_TYPE_SESSION, NULL, on_session_bus, g_object_ref(self));
+        g_timeout_add_seconds(RUN_DIALOG_PRELOAD_DELAY, budgie_preload_rundialog, NULL);
+}
+
+/**
+ * Report a startup milestone to budgie-session, if we're running under it
+ */
+static void budgie_trace_mark(GDBusConnection *bus, const gchar *mark)
+{
+        GVariantBuilder params;
+        GVariantBuilder platform_data;
+
+        g_variant_builder_init(&params, G_VARIANT_TYPE("av"));
+        g_variant_builder_add(&params, "v", g_variant_new_string(mark));
+        g_variant_builder_init(&platform_data, G_VARIANT_TYPE("a{sv}"));
+
+        g_dbus_connection_call(bus, SESSION_BUS_NAME, SESSION_OBJECT_PATH,
+                "org.gtk.Actions", "Activate",
+                g_variant_new("(sava{sv})", "trace-mark", &params, &platform_data),
+                NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL, NULL, NULL);
+}
+
+static void on_session_bus(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+        BudgieWM *self = BUDGIE_WM(user_data);
+        GError *error = NULL;
+
+        self->priv->session_bus = g_bus_get_finish(res, &error);
+        if (!self->priv->session_bus) {
+                g_warning("Unable to connect to the session bus: %s", error->message);
+                g_error_free(error);
+                g_object_unref(self);
+                return;
+        }
+        /* Tell the session we're ready */
+        g_bus_own_name_on_connection(self->priv->session_bus, BUDGIE_WM_BUS_NAME,
+                G_BUS_NAME_OWNER_FLAGS_NONE, NULL, NULL, NULL, NULL);
+        budgie_trace_mark(self->priv->session_bus, "budgie-wm: started");
+        budgie_animation_export(self->priv->session_bus);
+        g_object_unref(self);
 }
 
 /* Budgie specific callbacks */
@@ -154,6 +220,29 @@ static void budgie_launch_menu(MetaDisplay *display,
         g_spawn_command_line_async("budgie-panel --menu", NULL);
 }
 
+static gboolean budgie_preload_rundialog(gpointer user_data)
+{
+        /* Exits straight away if it's already resident */
+        g_spawn_command_line_async(RUN_DIALOG_BINARY " --resident", NULL);
+        return FALSE;
+}
+
+static void on_rundialog_toggled(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+        GVariant *ret = NULL;
+        GError *error = NULL;
+
+        ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+        if (ret) {
+                g_variant_unref(ret);
+                return;
+        }
+        /* Not running (yet), so start it the old fashioned way. It then
+         * stays resident for the next time. */
+        g_error_free(error);
+        g_spawn_command_line_async(RUN_DIALOG_BINARY, NULL);
+}
+
 static void budgie_launch_rundialog(MetaDisplay *display,
                                      MetaScreen *screen,
                                      MetaWindow *window,
@@ -161,9 +250,30 @@ static void budgie_launch_rundialog(MetaDisplay *display,
                                      MetaKeyBinding *binding,
                                      gpointer user_data)
 {
-        /* Run the budgie-run-dialog
-        * TODO: Make this path customisable */
-        g_spawn_command_line_async("budgie-run-dialog", NULL);
+        BudgieWM *self = BUDGIE_WM(user_data);
+        GVariantBuilder params;
+        GVariantBuilder platform_data;
+        guint32 timestamp;
+
+        if (!self->priv->session_bus) {
+                g_spawn_command_line_async(RUN_DIALOG_BINARY, NULL);
+                return;
+        }
+
+        /* Event time, so the dialog is allowed to take focus */
+        timestamp = clutter_event_get_time((ClutterEvent*)event);
+
+        g_variant_builder_init(&params, G_VARIANT_TYPE("av"));
+        g_variant_builder_add(&params, "v", g_variant_new_uint32(timestamp));
+        g_variant_builder_init(&platform_data, G_VARIANT_TYPE("a{sv}"));
+
+        /* Toggle the resident dialog: org.gtk.Actions.Activate("toggle") */
+        g_dbus_connection_call(self->priv->session_bus,
+                RUN_DIALOG_BUS_NAME, RUN_DIALOG_OBJECT_PATH,
+                "org.gtk.Actions", "Activate",
+                g_variant_new("(sava{sv})", "toggle", &params, &platform_data),
+                NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL,
+                on_rundialog_toggled, NULL);
 }
 
 static const MetaPluginInfo *budgie_plugin_info(MetaPlugin *plugin)
@@ -21,6 +21,9 @@
 #define MGETWINDOW(x) meta_window_actor_get_meta_window(x)
 #define MWT(x) MGETWINDOWTYPE(MGETWINDOW(x))
 
+/** Shared effect animations */
+#include "impl/animation.h"
+
 /** Included during transition period for functions still not in impl/ */
 #include "legacy.h"
 
@@ -0,0 +1,714 @@
+/*
+ * animation.c - Shared window effect animations
+ *
+ * Copyright 2015 Ikey Doherty <ikey@evolve-os.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <gio/gio.h>
+
+#include "impl.h"
+#include "plugin.h"
+
+#define ANIMATION_DATA_KEY "budgie-animation"
+#define ANIMATION_TRANSITION "budgie-effect"
+#define BATCH_DATA_KEY "budgie-animation-batch"
+
+#define ANIMATIONS_KEY "enable-animations"
+
+/* Frame intervals are averaged over this many frames of animation */
+#define SAMPLE_FRAMES 15
+/* Anything slower than ~30fps on average counts as a slow sample */
+#define SLOW_FRAME_US 33000
+/* Consecutive slow samples before dropping a quality level */
+#define SLOW_SAMPLES 2
+/* Seconds before trying the next quality level up again. Doubled each time
+ * we have to drop right back down within PROBE_PERIOD of recovering. */
+#define RECOVER_DELAY 5
+#define RECOVER_DELAY_MAX 120
+#define PROBE_PERIOD 30
+
+#define ANIMATION_OBJECT_PATH "/com/evolve_os/BudgieWM"
+#define ANIMATION_INTERFACE "com.evolve_os.BudgieWM.Animation"
+
+/**
+ * Effects get cheaper as the compositor falls behind
+ */
+typedef enum {
+        QUALITY_FULL = 0, /* Everything */
+        QUALITY_FADE, /* Opacity only, the rest jumps at the end */
+        QUALITY_NONE, /* Complete right away */
+} AnimationQuality;
+
+static const gchar *quality_names[] = { "full", "fade", "none" };
+
+/**
+ * Switching decisions, exported over D-Bus for diagnosis
+ */
+static struct {
+        guint64 frames;
+        guint64 slow_samples;
+        guint degrades;
+        guint recoveries;
+        gint64 last_interval; /* Average of the last sample, in µs */
+} stats;
+
+static AnimationQuality quality = QUALITY_FULL;
+static guint n_ticking = 0;
+static gint64 last_frame = 0;
+static gint64 sample_time = 0;
+static guint sample_frames = 0;
+static guint slow_samples = 0;
+static guint recover_id = 0;
+static guint recover_delay = RECOVER_DELAY;
+static gint64 last_recovery = 0;
+
+static ClutterActor *frame_stage = NULL;
+static GDBusConnection *bus = NULL;
+static guint registration_id = 0;
+
+static const gchar introspection_xml[] =
+        "<node>"
+        "  <interface name='" ANIMATION_INTERFACE "'>"
+        "    <method name='GetStats'>"
+        "      <arg type='a{sv}' name='stats' direction='out'/>"
+        "    </method>"
+        "  </interface>"
+        "</node>";
+
+typedef struct _AnimationBatch AnimationBatch;
+
+/**
+ * Per actor animation state. The transitions are allocated the first time
+ * an actor animates on its own and then reused for every later effect on it.
+ */
+typedef struct {
+        ClutterActor *actor; /* Unowned, we live in its qdata */
+        ClutterTransition *group;
+        ClutterTransition *props[BUDGIE_N_ANIM_PROPS];
+        gdouble from[BUDGIE_N_ANIM_PROPS];
+        gdouble to[BUDGIE_N_ANIM_PROPS];
+        guint staged; /* Bitmask of props set for the next run */
+        guint active; /* Bitmask of props in the running animation */
+        guint animated; /* Those of them actually being interpolated */
+        gboolean running;
+        gboolean ticking; /* Has transitions on the stage clock */
+        AnimationBatch *batch; /* Set while driven by a shared timeline */
+        BudgieAnimationFunc done;
+        gpointer user_data;
+} BudgieAnimation;
+
+/**
+ * A single timeline driving every actor that started animating in the
+ * same frame. The batch lives in the timeline's data.
+ */
+struct _AnimationBatch {
+        ClutterTimeline *timeline;
+        GPtrArray *members; /* BudgieAnimation, NULL once finished early */
+        guint duration;
+        ClutterAnimationMode mode;
+        gboolean finished;
+};
+
+/* Accepting new members until its first frame */
+static AnimationBatch *open_batch = NULL;
+
+static const struct {
+        const gchar *name;
+        GType type;
+} anim_props[BUDGIE_N_ANIM_PROPS] = {
+        [BUDGIE_ANIM_OPACITY] = { "opacity", G_TYPE_UINT },
+        [BUDGIE_ANIM_SCALE_X] = { "scale-x", G_TYPE_DOUBLE },
+        [BUDGIE_ANIM_SCALE_Y] = { "scale-y", G_TYPE_DOUBLE },
+        [BUDGIE_ANIM_X] = { "x", G_TYPE_FLOAT },
+        [BUDGIE_ANIM_Y] = { "y", G_TYPE_FLOAT },
+        [BUDGIE_ANIM_TRANSLATION_X] = { "translation-x", G_TYPE_FLOAT },
+        [BUDGIE_ANIM_TRANSLATION_Y] = { "translation-y", G_TYPE_FLOAT },
+};
+
+/* Settings keys holding the effect durations */
+static const gchar *effect_keys[BUDGIE_N_EFFECTS] = {
+        [BUDGIE_EFFECT_MAP] = "map-duration",
+        [BUDGIE_EFFECT_MENU_MAP] = "menu-map-duration",
+        [BUDGIE_EFFECT_MINIMIZE] = "minimize-duration",
+        [BUDGIE_EFFECT_DESTROY] = "destroy-duration",
+        [BUDGIE_EFFECT_SWITCH_WORKSPACE] = "switch-workspace-duration",
+};
+
+static GQuark animation_quark = 0;
+static GSettings *settings = NULL;
+static gboolean enabled = TRUE;
+static guint durations[BUDGIE_N_EFFECTS];
+
+static void on_settings_changed(GSettings *settings, const gchar *key, gpointer user_data)
+{
+        enabled = g_settings_get_boolean(settings, ANIMATIONS_KEY);
+        for (int i = 0; i < BUDGIE_N_EFFECTS; i++) {
+                durations[i] = (guint)MAX(g_settings_get_int(settings, effect_keys[i]), 0);
+        }
+}
+
+static void reset_sample(void)
+{
+        last_frame = 0;
+        sample_time = 0;
+        sample_frames = 0;
+        slow_samples = 0;
+}
+
+static gboolean recover(gpointer user_data);
+
+static void set_quality(AnimationQuality q)
+{
+        g_debug("Animation quality: %s -> %s", quality_names[quality], quality_names[q]);
+        quality = q;
+        reset_sample();
+
+        if (recover_id > 0) {
+                g_source_remove(recover_id);
+                recover_id = 0;
+        }
+        if (quality != QUALITY_FULL) {
+                recover_id = g_timeout_add_seconds(recover_delay, recover, NULL);
+        }
+}
+
+static gboolean recover(gpointer user_data)
+{
+        recover_id = 0;
+        stats.recoveries++;
+        last_recovery = g_get_monotonic_time();
+        set_quality(quality - 1);
+        return FALSE;
+}
+
+static void degrade(void)
+{
+        gint64 now = g_get_monotonic_time();
+
+        /* Backing off again straight after recovering, so probe less often */
+        if (last_recovery > 0 && now - last_recovery < PROBE_PERIOD * G_USEC_PER_SEC) {
+                recover_delay = MIN(recover_delay * 2, RECOVER_DELAY_MAX);
+        } else {
+                recover_delay = RECOVER_DELAY;
+        }
+        stats.degrades++;
+        set_quality(quality + 1);
+}
+
+/**
+ * Measure the interval between frames while anything is animating, as the
+ * stage only redraws continuously then.
+ */
+static void on_after_paint(ClutterStage *stage, gpointer user_data)
+{
+        gint64 now;
+
+        if (n_ticking == 0) {
+                last_frame = 0;
+                return;
+        }
+        now = g_get_monotonic_time();
+        if (last_frame > 0) {
+                sample_time += now - last_frame;
+                sample_frames++;
+                stats.frames++;
+        }
+        last_frame = now;
+
+        if (sample_frames < SAMPLE_FRAMES) {
+                return;
+        }
+        stats.last_interval = sample_time / sample_frames;
+        sample_time = 0;
+        sample_frames = 0;
+
+        if (stats.last_interval <= SLOW_FRAME_US) {
+                slow_samples = 0;
+                return;
+        }
+        stats.slow_samples++;
+        if (++slow_samples >= SLOW_SAMPLES && quality < QUALITY_NONE) {
+                degrade();
+        }
+}
+
+static void on_method_call(GDBusConnection *connection, const gchar *sender,
+                           const gchar *object_path, const gchar *interface_name,
+                           const gchar *method_name, GVariant *parameters,
+                           GDBusMethodInvocation *invocation, gpointer user_data)
+{
+        GVariantBuilder builder;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "enabled", g_variant_new_boolean(enabled));
+        g_variant_builder_add(&builder, "{sv}", "quality", g_variant_new_string(quality_names[quality]));
+        g_variant_builder_add(&builder, "{sv}", "degrades", g_variant_new_uint32(stats.degrades));
+        g_variant_builder_add(&builder, "{sv}", "recoveries", g_variant_new_uint32(stats.recoveries));
+        g_variant_builder_add(&builder, "{sv}", "frames", g_variant_new_uint64(stats.frames));
+        g_variant_builder_add(&builder, "{sv}", "slow-samples", g_variant_new_uint64(stats.slow_samples));
+        g_variant_builder_add(&builder, "{sv}", "frame-interval-us", g_variant_new_int64(stats.last_interval));
+        g_variant_builder_add(&builder, "{sv}", "recover-delay", g_variant_new_uint32(recover_delay));
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a{sv})", &builder));
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+        on_method_call, NULL, NULL
+};
+
+void budgie_animation_init(ClutterActor *stage)
+{
+        if (settings) {
+                return;
+        }
+        settings = g_settings_new(BUDGIE_WM_SCHEMA);
+        g_signal_connect(settings, "changed", G_CALLBACK(on_settings_changed), NULL);
+        on_settings_changed(settings, NULL, NULL);
+
+        frame_stage = g_object_ref(stage);
+        g_signal_connect(frame_stage, "after-paint", G_CALLBACK(on_after_paint), NULL);
+}
+
+void budgie_animation_export(GDBusConnection *connection)
+{
+        GDBusNodeInfo *info;
+        GError *error = NULL;
+
+        if (registration_id > 0) {
+                return;
+        }
+        info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+        registration_id = g_dbus_connection_register_object(connection,
+                ANIMATION_OBJECT_PATH, info->interfaces[0], &interface_vtable,
+                NULL, NULL, &error);
+        g_dbus_node_info_unref(info);
+        if (registration_id == 0) {
+                g_warning("Unable to export animation stats: %s", error->message);
+                g_error_free(error);
+                return;
+        }
+        bus = g_object_ref(connection);
+}
+
+void budgie_animation_shutdown(void)
+{
+        if (registration_id > 0) {
+                g_dbus_connection_unregister_object(bus, registration_id);
+                registration_id = 0;
+        }
+        g_clear_object(&bus);
+        if (recover_id > 0) {
+                g_source_remove(recover_id);
+                recover_id = 0;
+        }
+        if (frame_stage) {
+                g_signal_handlers_disconnect_by_func(frame_stage, G_CALLBACK(on_after_paint), NULL);
+                g_clear_object(&frame_stage);
+        }
+        g_clear_object(&settings);
+}
+
+gboolean budgie_animation_enabled(void)
+{
+        return enabled && quality != QUALITY_NONE;
+}
+
+guint budgie_animation_get_duration(BudgieEffect effect)
+{
+        g_return_val_if_fail(effect < BUDGIE_N_EFFECTS, 0);
+        return budgie_animation_enabled() ? durations[effect] : 0;
+}
+
+static void set_value(ClutterActor *actor, BudgieAnimProperty prop, gdouble value)
+{
+        switch (anim_props[prop].type) {
+                case G_TYPE_UINT:
+                        g_object_set(actor, anim_props[prop].name, (guint)value, NULL);
+                        break;
+                case G_TYPE_FLOAT:
+                        g_object_set(actor, anim_props[prop].name, (gfloat)value, NULL);
+                        break;
+                default:
+                        g_object_set(actor, anim_props[prop].name, value, NULL);
+                        break;
+        }
+}
+
+/**
+ * Bring the actor to its target values, drop the transitions and let the
+ * effect know we're done. Only ever runs once per animation.
+ */
+static void animation_finish(BudgieAnimation *anim)
+{
+        ClutterActor *actor = anim->actor;
+        ClutterTransition *group = anim->group;
+        BudgieAnimationFunc done;
+        gpointer user_data;
+
+        if (!anim->running) {
+                return;
+        }
+        anim->running = FALSE;
+        if (anim->ticking) {
+                anim->ticking = FALSE;
+                n_ticking--;
+        }
+
+        /* The done callback may well get the actor destroyed */
+        g_object_ref(actor);
+
+        if (group) {
+                g_object_ref(group);
+                if (clutter_actor_get_transition(actor, ANIMATION_TRANSITION) == group) {
+                        clutter_actor_remove_transition(actor, ANIMATION_TRANSITION);
+                }
+                /* Otherwise the transitions keep the actor alive */
+                for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                        if (anim->animated & (1 << i)) {
+                                clutter_transition_set_animatable(anim->props[i], NULL);
+                        }
+                }
+                clutter_transition_set_animatable(group, NULL);
+        }
+        for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                if (anim->active & (1 << i)) {
+                        set_value(actor, i, anim->to[i]);
+                }
+        }
+        anim->active = 0;
+        anim->animated = 0;
+
+        done = anim->done;
+        user_data = anim->user_data;
+        anim->done = NULL;
+        anim->user_data = NULL;
+        if (done) {
+                done(actor, user_data);
+        }
+
+        if (group) {
+                g_object_unref(group);
+        }
+        g_object_unref(actor);
+}
+
+static void on_group_stopped(ClutterTimeline *timeline, gboolean is_finished, gpointer user_data)
+{
+        animation_finish(user_data);
+}
+
+static void free_animation(gpointer data)
+{
+        BudgieAnimation *anim = data;
+
+        if (G_UNLIKELY(anim == NULL)) {
+                return;
+        }
+        if (anim->group) {
+                g_signal_handlers_disconnect_by_func(anim->group, G_CALLBACK(on_group_stopped), anim);
+                g_object_unref(anim->group);
+                for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                        g_object_unref(anim->props[i]);
+                }
+        }
+        g_slice_free(BudgieAnimation, anim);
+}
+
+static BudgieAnimation *get_animation(ClutterActor *actor, gboolean create)
+{
+        BudgieAnimation *anim;
+
+        if (G_UNLIKELY(animation_quark == 0)) {
+                animation_quark = g_quark_from_static_string(ANIMATION_DATA_KEY);
+        }
+
+        anim = g_object_get_qdata(G_OBJECT(actor), animation_quark);
+        if (anim || !create) {
+                return anim;
+        }
+
+        anim = g_slice_new0(BudgieAnimation);
+        anim->actor = actor;
+        g_object_set_qdata_full(G_OBJECT(actor), animation_quark, anim, free_animation);
+        return anim;
+}
+
+static void ensure_transitions(BudgieAnimation *anim)
+{
+        if (anim->group) {
+                return;
+        }
+        anim->group = clutter_transition_group_new();
+        for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                anim->props[i] = clutter_property_transition_new(anim_props[i].name);
+                clutter_transition_set_interval(anim->props[i],
+                        clutter_interval_new_with_values(anim_props[i].type, NULL, NULL));
+        }
+        g_signal_connect(anim->group, "stopped", G_CALLBACK(on_group_stopped), anim);
+}
+
+void budgie_animation_set(ClutterActor *actor, BudgieAnimProperty prop,
+                          gdouble from, gdouble to)
+{
+        BudgieAnimation *anim;
+
+        g_return_if_fail(prop < BUDGIE_N_ANIM_PROPS);
+
+        anim = get_animation(actor, TRUE);
+        anim->from[prop] = from;
+        anim->to[prop] = to;
+        anim->staged |= 1 << prop;
+}
+
+static void set_interval(ClutterTransition *transition, GType type, gdouble from, gdouble to)
+{
+        if (type == G_TYPE_UINT) {
+                clutter_transition_set_from(transition, type, (guint)from);
+                clutter_transition_set_to(transition, type, (guint)to);
+        } else {
+                /* Floats are promoted, and collected as such */
+                clutter_transition_set_from(transition, type, from);
+                clutter_transition_set_to(transition, type, to);
+        }
+}
+
+/**
+ * Take over the staged transitions, completing any earlier animation.
+ *
+ * @return the properties to interpolate, or 0 if the animation has
+ * already been completed
+ */
+static guint animation_begin(BudgieAnimation *anim, guint duration,
+                             BudgieAnimationFunc done, gpointer user_data)
+{
+        guint staged = anim->staged;
+        guint animated = 0;
+
+        /* Complete whatever was going on before */
+        budgie_animation_cancel(anim->actor);
+
+        anim->staged = 0;
+        anim->active = staged;
+        anim->done = done;
+        anim->user_data = user_data;
+        anim->running = TRUE;
+
+        for (int i = 0; i < BUDGIE_N_ANIM_PROPS && duration > 0; i++) {
+                if (!(staged & (1 << i))) {
+                        continue;
+                }
+                /* Leave it be until the end, where it jumps to its target */
+                if (quality == QUALITY_FADE && i != BUDGIE_ANIM_OPACITY) {
+                        continue;
+                }
+                animated |= 1 << i;
+        }
+        if (animated == 0) {
+                animation_finish(anim);
+                return 0;
+        }
+
+        /* Start from a known state, not whatever gets painted first */
+        for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                if (animated & (1 << i)) {
+                        set_value(anim->actor, i, anim->from[i]);
+                }
+        }
+        anim->animated = animated;
+        anim->ticking = TRUE;
+        n_ticking++;
+        return animated;
+}
+
+void budgie_animation_run(ClutterActor *actor, guint duration,
+                          ClutterAnimationMode mode,
+                          BudgieAnimationFunc done, gpointer user_data)
+{
+        BudgieAnimation *anim = get_animation(actor, TRUE);
+        ClutterTransitionGroup *group;
+        guint animated;
+
+        animated = animation_begin(anim, duration, done, user_data);
+        if (animated == 0) {
+                return;
+        }
+
+        ensure_transitions(anim);
+        group = CLUTTER_TRANSITION_GROUP(anim->group);
+        clutter_transition_group_remove_all(group);
+        for (int i = 0; i < BUDGIE_N_ANIM_PROPS; i++) {
+                ClutterTransition *t = anim->props[i];
+
+                if (!(animated & (1 << i))) {
+                        continue;
+                }
+                set_interval(t, anim_props[i].type, anim->from[i], anim->to[i]);
+                clutter_timeline_set_duration(CLUTTER_TIMELINE(t), duration);
+                clutter_timeline_set_progress_mode(CLUTTER_TIMELINE(t), mode);
+                clutter_timeline_rewind(CLUTTER_TIMELINE(t));
+                clutter_transition_set_animatable(t, CLUTTER_ANIMATABLE(actor));
+                clutter_transition_group_add_transition(group, t);
+        }
+        clutter_timeline_set_duration(CLUTTER_TIMELINE(group), duration);
+        clutter_timeline_rewind(CLUTTER_TIMELINE(group));
+
+        /* Starts the group */
+        clutter_actor_add_transition(actor, ANIMATION_TRANSITION, anim->group);
+}
+
+static void on_batch_frame(ClutterTimeline *timeline, gint msecs, gpointer user_data)
+{
+        AnimationBatch *batch = user_data;
+        gdouble progress = clutter_timeline_get_progress(timeline);
+
+        /* Anything mapping from now on is a frame late for this one */
+        if (open_batch == batch) {
+                open_batch = NULL;
+        }
+
+        for (guint i = 0; i < batch->members->len; i++) {
+                BudgieAnimation *anim = g_ptr_array_index(batch->members, i);
+
+                if (!anim) {
+                        continue;
+                }
+                for (int j = 0; j < BUDGIE_N_ANIM_PROPS; j++) {
+                        if (anim->animated & (1 << j)) {
+                                set_value(anim->actor, j,
+                                        anim->from[j] + (anim->to[j] - anim->from[j]) * progress);
+                        }
+                }
+        }
+}
+
+/**
+ * Finish a batch member, and give up its reference on the actor
+ */
+static void batch_finish_member(AnimationBatch *batch, guint index)
+{
+        BudgieAnimation *anim = g_ptr_array_index(batch->members, index);
+        ClutterActor *actor = anim->actor;
+
+        g_ptr_array_index(batch->members, index) = NULL;
+        anim->batch = NULL;
+        animation_finish(anim);
+        g_object_unref(actor);
+}
+
+static void on_batch_stopped(ClutterTimeline *timeline, gboolean is_finished, gpointer user_data)
+{
+        AnimationBatch *batch = user_data;
+
+        if (batch->finished) {
+                return;
+        }
+        batch->finished = TRUE;
+        if (open_batch == batch) {
+                open_batch = NULL;
+        }
+
+        /* Everyone completes in one pass */
+        for (guint i = 0; i < batch->members->len; i++) {
+                if (g_ptr_array_index(batch->members, i)) {
+                        batch_finish_member(batch, i);
+                }
+        }
+        /* The running batch's reference, the batch goes with it */
+        g_object_unref(timeline);
+}
+
+static void free_batch(gpointer data)
+{
+        AnimationBatch *batch = data;
+
+        g_ptr_array_unref(batch->members);
+        g_slice_free(AnimationBatch, batch);
+}
+
+static AnimationBatch *batch_new(guint duration, ClutterAnimationMode mode)
+{
+        AnimationBatch *batch = g_slice_new0(AnimationBatch);
+
+        batch->members = g_ptr_array_new();
+        batch->duration = duration;
+        batch->mode = mode;
+        batch->timeline = clutter_timeline_new(duration);
+        clutter_timeline_set_progress_mode(batch->timeline, mode);
+        g_object_set_data_full(G_OBJECT(batch->timeline), BATCH_DATA_KEY, batch, free_batch);
+        g_signal_connect(batch->timeline, "new-frame", G_CALLBACK(on_batch_frame), batch);
+        g_signal_connect(batch->timeline, "stopped", G_CALLBACK(on_batch_stopped), batch);
+        clutter_timeline_start(batch->timeline);
+        return batch;
+}
+
+void budgie_animation_run_batched(ClutterActor *actor, guint duration,
+                                  ClutterAnimationMode mode,
+                                  BudgieAnimationFunc done, gpointer user_data)
+{
+        BudgieAnimation *anim = get_animation(actor, TRUE);
+        AnimationBatch *batch = open_batch;
+
+        if (animation_begin(anim, duration, done, user_data) == 0) {
+                return;
+        }
+
+        if (!batch || batch->duration != duration || batch->mode != mode) {
+                batch = batch_new(duration, mode);
+                open_batch = batch;
+        }
+        anim->batch = batch;
+        g_ptr_array_add(batch->members, anim);
+        g_object_ref(actor);
+}
+
+/**
+ * Finish a single actor early, stopping the timeline if it was the last
+ */
+static void batch_remove(BudgieAnimation *anim)
+{
+        AnimationBatch *batch = anim->batch;
+        ClutterTimeline *timeline = g_object_ref(batch->timeline);
+        gboolean empty = TRUE;
+
+        for (guint i = 0; i < batch->members->len; i++) {
+                if (g_ptr_array_index(batch->members, i) == anim) {
+                        batch_finish_member(batch, i);
+                }
+        }
+        for (guint i = 0; i < batch->members->len; i++) {
+                if (g_ptr_array_index(batch->members, i)) {
+                        empty = FALSE;
+                }
+        }
+        if (empty && !batch->finished) {
+                clutter_timeline_stop(timeline);
+        }
+        g_object_unref(timeline);
+}
+
+void budgie_animation_cancel(ClutterActor *actor)
+{
+        BudgieAnimation *anim = get_animation(actor, FALSE);
+        ClutterTimeline *group;
+
+        if (!anim || !anim->running) {
+                return;
+        }
+        if (anim->batch) {
+                batch_remove(anim);
+                return;
+        }
+
+        /* The stopped handler finishes up, and may free anim along the way */
+        group = g_object_ref(CLUTTER_TIMELINE(anim->group));
+        if (clutter_timeline_is_playing(group)) {
+                clutter_timeline_stop(group);
+        } else {
+                animation_finish(anim);
+        }
+        g_object_unref(group);
+}
@@ -0,0 +1,97 @@
+/*
+ * animation.h
+ *
+ * Copyright 2015 Ikey Doherty <ikey@evolve-os.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#pragma once
+
+#include <clutter/clutter.h>
+#include <gio/gio.h>
+
+/**
+ * Properties an animation may drive
+ */
+typedef enum {
+        BUDGIE_ANIM_OPACITY = 0,
+        BUDGIE_ANIM_SCALE_X,
+        BUDGIE_ANIM_SCALE_Y,
+        BUDGIE_ANIM_X,
+        BUDGIE_ANIM_Y,
+        BUDGIE_ANIM_TRANSLATION_X,
+        BUDGIE_ANIM_TRANSLATION_Y,
+        BUDGIE_N_ANIM_PROPS
+} BudgieAnimProperty;
+
+/**
+ * Effects with a configurable duration
+ */
+typedef enum {
+        BUDGIE_EFFECT_MAP = 0,
+        BUDGIE_EFFECT_MENU_MAP,
+        BUDGIE_EFFECT_MINIMIZE,
+        BUDGIE_EFFECT_DESTROY,
+        BUDGIE_EFFECT_SWITCH_WORKSPACE,
+        BUDGIE_N_EFFECTS
+} BudgieEffect;
+
+/**
+ * Called exactly once when an animation finishes or is cancelled, at
+ * which point the actor has reached its target values.
+ */
+typedef void (*BudgieAnimationFunc)(ClutterActor *actor, gpointer user_data);
+
+/**
+ * Load the animation settings and start watching the stage's frame rate,
+ * call once from plugin start. Effects get cheaper while the stage can't
+ * keep up, and are restored once it does again.
+ */
+void budgie_animation_init(ClutterActor *stage);
+
+/** Export the quality switching counters on the session bus */
+void budgie_animation_export(GDBusConnection *bus);
+
+/** Drop the animation settings */
+void budgie_animation_shutdown(void);
+
+/** Whether animations are enabled at all, at the current quality */
+gboolean budgie_animation_enabled(void);
+
+/**
+ * Configured duration of an effect in milliseconds. 0 means the effect
+ * should be skipped and completed right away.
+ */
+guint budgie_animation_get_duration(BudgieEffect effect);
+
+/**
+ * Stage a property transition for the next budgie_animation_run()
+ */
+void budgie_animation_set(ClutterActor *actor, BudgieAnimProperty prop,
+                          gdouble from, gdouble to);
+
+/**
+ * Run all staged transitions on the actor as one animation, completing
+ * any animation already running on it first.
+ */
+void budgie_animation_run(ClutterActor *actor, guint duration,
+                          ClutterAnimationMode mode,
+                          BudgieAnimationFunc done, gpointer user_data);
+
+/**
+ * Like budgie_animation_run(), but actors starting within the same frame
+ * share one timeline, and are completed together in a single pass.
+ */
+void budgie_animation_run_batched(ClutterActor *actor, guint duration,
+                                  ClutterAnimationMode mode,
+                                  BudgieAnimationFunc done, gpointer user_data);
+
+/**
+ * Jump a running animation to its end and invoke its callback. Safe to
+ * call at any time, including on actors that never animated.
+ */
+void budgie_animation_cancel(ClutterActor *actor);
@@ -11,9 +11,6 @@
 
 #include "impl.h"
 
-/** Duration of destroy animation */
-#define DESTROY_TIMEOUT    130
-
 /** What size to scale them to */
 #define DESTROY_SCALE      0.6
 
@@ -24,36 +21,35 @@ static ClutterPoint PV_CENTER = { 0.5f, 0.5f };
 /**
  * notify mutter
  */
-static void destroy_done(ClutterActor *actor, MetaPlugin *plugin)
+static void destroy_done(ClutterActor *actor, gpointer plugin)
 {
-        clutter_actor_remove_all_transitions(actor);
-        g_signal_handlers_disconnect_by_func(actor, G_CALLBACK(destroy_done), plugin);
-        meta_plugin_destroy_completed(plugin, META_WINDOW_ACTOR(actor));
+        meta_plugin_destroy_completed(META_PLUGIN(plugin), META_WINDOW_ACTOR(actor));
 }
 
 void destroy(MetaPlugin *plugin, MetaWindowActor *window_actor)
 {
         ClutterActor *actor = CLUTTER_ACTOR(window_actor);
-
-        clutter_actor_remove_all_transitions(actor);
+        guint duration = budgie_animation_get_duration(BUDGIE_EFFECT_DESTROY);
+        gdouble scale_x, scale_y;
 
         switch (MWT(window_actor)) {
                 case META_WINDOW_NORMAL:
                 case META_WINDOW_DIALOG:
                 case META_WINDOW_MODAL_DIALOG:
+                        if (duration == 0) {
+                                break;
+                        }
                         /* Initialise animation */
+                        clutter_actor_get_scale(actor, &scale_x, &scale_y);
                         g_object_set(actor, "pivot-point", &PV_CENTER, NULL);
-                        clutter_actor_save_easing_state(actor);
-                        clutter_actor_set_easing_mode(actor, CLUTTER_EASE_OUT_QUAD);
-                        clutter_actor_set_easing_duration(actor, DESTROY_TIMEOUT);
-                        g_signal_connect(actor, "transitions-completed", G_CALLBACK(destroy_done), plugin);
-
-                        /* Now animate. */
-                        g_object_set(actor, "scale-x", DESTROY_SCALE, "scale-y", DESTROY_SCALE, "opacity", 0, NULL);
-                        clutter_actor_restore_easing_state(actor);
-                        break;
+                        budgie_animation_set(actor, BUDGIE_ANIM_OPACITY, clutter_actor_get_opacity(actor), 0);
+                        budgie_animation_set(actor, BUDGIE_ANIM_SCALE_X, scale_x, DESTROY_SCALE);
+                        budgie_animation_set(actor, BUDGIE_ANIM_SCALE_Y, scale_y, DESTROY_SCALE);
+                        budgie_animation_run(actor, duration, CLUTTER_EASE_OUT_QUAD, destroy_done, plugin);
+                        return;
                 default:
-                        meta_plugin_destroy_completed(plugin, window_actor);
                         break;
         }
+        budgie_animation_cancel(actor);
+        meta_plugin_destroy_completed(plugin, window_actor);
 }
@@ -11,9 +11,6 @@
 
 #include "impl.h"
 
-/** Duration of minimize animation */
-#define MINIMIZE_TIMEOUT   200
-
 static ClutterPoint PV_CENTER = { 0.5f, 0.5f };
 static ClutterPoint PV_NORM = { 0.0f, 0.0f };
 
@@ -22,23 +19,21 @@ static ClutterPoint PV_NORM = { 0.0f, 0.0f };
 /**
  * notify mutter
  */
-static void minimize_done(ClutterActor *actor, MetaPlugin *plugin)
+static void minimize_done(ClutterActor *actor, gpointer plugin)
 {
-        clutter_actor_remove_all_transitions(actor);
-        g_signal_handlers_disconnect_by_func(actor, G_CALLBACK(minimize_done), plugin);
         g_object_set(actor, "pivot-point", &PV_NORM, "opacity", 255, "scale-x", 1.0, "scale-y", 1.0, NULL);
         clutter_actor_hide(actor);
-        meta_plugin_minimize_completed(plugin, META_WINDOW_ACTOR(actor));
+        meta_plugin_minimize_completed(META_PLUGIN(plugin), META_WINDOW_ACTOR(actor));
 }
 
 void minimize(MetaPlugin *plugin, MetaWindowActor *window_actor)
 {
         ClutterActor *actor = CLUTTER_ACTOR(window_actor);
         MetaRectangle icon;
+        guint duration = budgie_animation_get_duration(BUDGIE_EFFECT_MINIMIZE);
 
-        clutter_actor_remove_all_transitions(actor);
-
-        if (MWT(window_actor) != META_WINDOW_NORMAL) {
+        if (MWT(window_actor) != META_WINDOW_NORMAL || duration == 0) {
+                budgie_animation_cancel(actor);
                 meta_plugin_minimize_completed(plugin, window_actor);
                 return;
         }
@@ -50,12 +45,10 @@ void minimize(MetaPlugin *plugin, MetaWindowActor *window_actor)
 
         /* Initialise animation */
         g_object_set(actor, "pivot-point", &PV_CENTER, NULL);
-        clutter_actor_save_easing_state(actor);
-        clutter_actor_set_easing_mode(actor, CLUTTER_EASE_IN_SINE);
-        clutter_actor_set_easing_duration(actor, MINIMIZE_TIMEOUT);
-        g_signal_connect(actor, "transitions-completed", G_CALLBACK(minimize_done), plugin);
-
-        /* Now animate. */
-        g_object_set(actor, "opacity", 0, "x", (double)icon.x, "y", (double)icon.y, "scale-x", 0.0, "scale-y", 0.0, NULL);
-        clutter_actor_restore_easing_state(actor);
+        budgie_animation_set(actor, BUDGIE_ANIM_OPACITY, clutter_actor_get_opacity(actor), 0);
+        budgie_animation_set(actor, BUDGIE_ANIM_X, clutter_actor_get_x(actor), icon.x);
+        budgie_animation_set(actor, BUDGIE_ANIM_Y, clutter_actor_get_y(actor), icon.y);
+        budgie_animation_set(actor, BUDGIE_ANIM_SCALE_X, 1.0, 0.0);
+        budgie_animation_set(actor, BUDGIE_ANIM_SCALE_Y, 1.0, 0.0);
+        budgie_animation_run(actor, duration, CLUTTER_EASE_IN_SINE, minimize_done, plugin);
 }
@@ -1,8 +1,8 @@
 /*
  * tabs.c
- * 
+ *
  * Copyright 2015 Ikey Doherty <ikey@evolve-os.com>
- * 
+ *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 2 of the License, or
@@ -11,42 +11,198 @@
 
 #include "impl.h"
 #include <meta/display.h>
+#include <meta/workspace.h>
+#include <string.h>
 
 #define MAX_TAB_ELAPSE 500
 
-static MetaWorkspace *cur_workspace = NULL;
-static GList *cur_tabs = NULL;
+#define TAB_LIST_KEY "budgie-tab-list"
+
+/**
+ * Per workspace most-recently-used window list, kept up to date as windows
+ * come, go and get focused so that we never need to rebuild it.
+ */
+typedef struct {
+        MetaWorkspace *workspace;
+        GPtrArray *mru; /* MetaWindow, most recently used first */
+        MetaWindow *deferred; /* Focused mid-switch, moved up once we're done */
+        gulong added_id;
+        gulong removed_id;
+} TabList;
+
+static GQuark tab_list_quark = 0;
+static GSList *tab_lists = NULL;
+static MetaDisplay *tab_display = NULL;
+static gulong focus_id = 0;
+
+static TabList *cur_list = NULL;
 static guint cur_index = 0;
-static guint32 last_time = -1;
+static guint32 last_time = 0;
 
-static gint tab_sort(const MetaWindow *a, const MetaWindow *b)
+static gboolean in_tab_chain(MetaWindow *window)
 {
-        guint32 at, bt;
-        at = meta_window_get_user_time((MetaWindow*)a);
-        bt = meta_window_get_user_time((MetaWindow*)b);
-        return (at < bt) ? -1 : (at > bt);
+        MetaWindowType type = meta_window_get_window_type(window);
+
+        return type != META_WINDOW_DOCK && type != META_WINDOW_DESKTOP &&
+                !meta_window_is_skip_taskbar(window) &&
+                !meta_window_is_override_redirect(window);
 }
 
-/* Refresh the current tab list. Ideally we need to refresh it when we're
- * "done" alt+tabbing, but we have no UI component yet.
- */
-static void invalidate_tab(MetaWorkspace *space, MetaWindow *window, gpointer udata)
+static gint mru_find(TabList *list, MetaWindow *window)
 {
-        if (space == cur_workspace) {
-                if (cur_tabs) {
-                        g_list_free(cur_tabs);
+        for (guint i = 0; i < list->mru->len; i++) {
+                if (g_ptr_array_index(list->mru, i) == window) {
+                        return (gint)i;
                 }
-                cur_tabs = NULL;
-                cur_index = 0;
-                last_time = -1;
         }
+        return -1;
+}
+
+/**
+ * Move the window to the front of the list
+ */
+static void mru_touch(TabList *list, MetaWindow *window)
+{
+        gint index = mru_find(list, window);
+        gpointer *pdata = list->mru->pdata;
+
+        if (index <= 0) {
+                return;
+        }
+        memmove(&pdata[1], &pdata[0], index * sizeof(gpointer));
+        pdata[0] = window;
+}
+
+static gboolean in_switch(guint32 time)
+{
+        return cur_list && last_time != 0 && time - last_time < MAX_TAB_ELAPSE;
+}
+
+static void on_window_added(MetaWorkspace *space, MetaWindow *window, gpointer udata)
+{
+        TabList *list = udata;
+
+        if (in_tab_chain(window) && mru_find(list, window) < 0) {
+                g_ptr_array_add(list->mru, window);
+        }
+}
+
+static void on_window_removed(MetaWorkspace *space, MetaWindow *window, gpointer udata)
+{
+        TabList *list = udata;
+        gint index = mru_find(list, window);
+
+        if (list->deferred == window) {
+                list->deferred = NULL;
+        }
+        if (index < 0) {
+                return;
+        }
+        g_ptr_array_remove_index(list->mru, (guint)index);
+
+        /* Keep stepping from the same window */
+        if (list == cur_list && cur_index >= (guint)index && cur_index > 0) {
+                cur_index--;
+        }
+}
+
+static void on_focus_window(MetaDisplay *display, GParamSpec *pspec, gpointer udata)
+{
+        MetaWindow *window = meta_display_get_focus_window(display);
+        MetaWorkspace *workspace;
+        TabList *list;
+
+        if (!window || !(workspace = meta_window_get_workspace(window))) {
+                return;
+        }
+        list = g_object_get_qdata(G_OBJECT(workspace), tab_list_quark);
+        if (!list) {
+                return;
+        }
+
+        /* Reordering now would shuffle the windows we're stepping through */
+        if (list == cur_list && in_switch(meta_display_get_current_time(display))) {
+                list->deferred = window;
+                return;
+        }
+        /* The switch is over, so catch up before this newer focus change */
+        if (list->deferred) {
+                mru_touch(list, list->deferred);
+                list->deferred = NULL;
+        }
+        mru_touch(list, window);
+}
+
+static void free_tab_list(gpointer data)
+{
+        TabList *list = data;
+
+        tab_lists = g_slist_remove(tab_lists, list);
+        if (list == cur_list) {
+                cur_list = NULL;
+        }
+        g_ptr_array_unref(list->mru);
+        g_slice_free(TabList, list);
+}
+
+/**
+ * Tab list for the workspace, built from mutter's own the first time and
+ * freed along with the workspace.
+ */
+static TabList *get_tab_list(MetaDisplay *display, MetaWorkspace *workspace)
+{
+        TabList *list;
+        GList *windows, *elem;
+
+        if (G_UNLIKELY(tab_list_quark == 0)) {
+                tab_list_quark = g_quark_from_static_string(TAB_LIST_KEY);
+        }
+
+        list = g_object_get_qdata(G_OBJECT(workspace), tab_list_quark);
+        if (list) {
+                return list;
+        }
+
+        if (!focus_id) {
+                tab_display = display;
+                focus_id = g_signal_connect(display, "notify::focus-window",
+                        G_CALLBACK(on_focus_window), NULL);
+        }
+
+        list = g_slice_new0(TabList);
+        list->workspace = workspace;
+        list->mru = g_ptr_array_new();
+
+        /* Already in most recently used order */
+        windows = meta_display_get_tab_list(display, META_TAB_LIST_NORMAL, workspace);
+        for (elem = windows; elem; elem = elem->next) {
+                g_ptr_array_add(list->mru, elem->data);
+        }
+        g_list_free(windows);
+
+        /* These go away with the workspace itself */
+        list->added_id = g_signal_connect(workspace, "window-added", G_CALLBACK(on_window_added), list);
+        list->removed_id = g_signal_connect(workspace, "window-removed", G_CALLBACK(on_window_removed), list);
+
+        g_object_set_qdata_full(G_OBJECT(workspace), tab_list_quark, list, free_tab_list);
+        tab_lists = g_slist_prepend(tab_lists, list);
+        return list;
 }
 
 void tabs_clean()
 {
-        if (cur_tabs) {
-                g_list_free(cur_tabs);
-                cur_tabs = NULL;
+        if (focus_id) {
+                g_signal_handler_disconnect(tab_display, focus_id);
+                focus_id = 0;
+                tab_display = NULL;
+        }
+        while (tab_lists) {
+                TabList *list = tab_lists->data;
+
+                g_signal_handler_disconnect(list->workspace, list->added_id);
+                g_signal_handler_disconnect(list->workspace, list->removed_id);
+                /* Frees it, and drops it from tab_lists */
+                g_object_set_qdata(G_OBJECT(list->workspace), tab_list_quark, NULL);
         }
 }
 
@@ -56,6 +212,7 @@ void switch_windows(MetaDisplay *display, MetaScreen     *screen,
 {
         MetaWorkspace *workspace = NULL;
         MetaWindow *win = NULL;
+        TabList *list;
         guint32 cur_time = meta_display_get_current_time(display);
 
         if (window) {
@@ -65,37 +222,23 @@ void switch_windows(MetaDisplay *display, MetaScreen     *screen,
                 workspace = meta_screen_get_active_workspace(screen);
         }
 
-        if (!g_object_get_data(G_OBJECT(workspace), "__flagged")) {
-                g_signal_connect(workspace, "window-added", G_CALLBACK(invalidate_tab), NULL);
-                g_signal_connect(workspace, "window-removed", G_CALLBACK(invalidate_tab), NULL);
-                g_object_set_data(G_OBJECT(workspace), "__flagged", "Ya.");
-        }
-
-        if (workspace != cur_workspace || cur_time - last_time >= MAX_TAB_ELAPSE) {
-                cur_workspace = workspace;
-                if (cur_tabs) {
-                        g_list_free(cur_tabs);
-                        cur_tabs = NULL;
-                        cur_index = 0;
+        list = get_tab_list(display, workspace);
+        if (list != cur_list || !in_switch(cur_time)) {
+                /* Starting over, so catch up on focus changes from last time */
+                if (cur_list && cur_list->deferred) {
+                        mru_touch(cur_list, cur_list->deferred);
+                        cur_list->deferred = NULL;
                 }
+                cur_list = list;
+                cur_index = 0;
         }
         last_time = cur_time;
 
-        if (!cur_tabs) {
-                cur_tabs = meta_display_get_tab_list(display, META_TAB_LIST_NORMAL, workspace);
-                cur_tabs = g_list_sort(cur_tabs, (GCompareFunc)tab_sort);
-        }
-        if (!cur_tabs) {
-                return;
-        }
-        cur_index++;
-        if (cur_index > g_list_length(cur_tabs)-1) {
-                cur_index = 0;
-        }
-        win = g_list_nth_data(cur_tabs, cur_index);
-        if (!win) {
+        if (list->mru->len == 0) {
                 return;
         }
+        cur_index = (cur_index + 1) % list->mru->len;
+        win = g_ptr_array_index(list->mru, cur_index);
 
-        meta_window_activate(win, meta_display_get_current_time(display));
+        meta_window_activate(win, cur_time);
 }
@@ -28,6 +28,7 @@
 
 #include <meta/meta-plugin.h>
 #include <meta/window.h>
+#include <meta/workspace.h>
 #include <meta/meta-background-group.h>
 #include <meta/meta-background-actor.h>
 #include <meta/prefs.h>
@@ -44,16 +45,13 @@
 
 #define MAXIMIZE_TIMEOUT   100
 #define BACKGROUND_TIMEOUT 250
-#define SWITCH_TIMEOUT    1
 
 #include "plugin.h"
 #include "impl.h"
 #include "background.h"
 
-#define ACTOR_DATA_KEY "MCCP-Default-actor-data"
 #define SCREEN_TILE_PREVIEW_DATA_KEY "MCCP-Default-screen-tile-preview-data"
 
-static GQuark actor_data_quark = 0;
 static GQuark screen_tile_preview_data_quark = 0;
 
 
@@ -66,184 +64,241 @@ typedef struct _ScreenTilePreview
   MetaRectangle   tile_rect;
 } ScreenTilePreview;
 
-/*
- * Actor private data accessor
- */
 static void
-free_actor_private (gpointer data)
-{
-  if (G_LIKELY (data != NULL))
-    g_slice_free (ActorPrivate, data);
-}
-
-ActorPrivate *
-get_actor_private (MetaWindowActor *actor)
+on_switch_actor_done (ClutterActor *actor, gpointer data)
 {
-  ActorPrivate *priv = g_object_get_qdata (G_OBJECT (actor), actor_data_quark);
+  MetaPlugin      *plugin = META_PLUGIN (data);
+  BudgieWMPrivate *priv   = BUDGIE_WM (plugin)->priv;
 
-  if (G_UNLIKELY (actor_data_quark == 0))
-    actor_data_quark = g_quark_from_static_string (ACTOR_DATA_KEY);
+  clutter_actor_set_translation (actor, 0.0, 0.0, 0.0);
 
-  if (G_UNLIKELY (!priv))
-    {
-      priv = g_slice_new0 (ActorPrivate);
-
-      g_object_set_qdata_full (G_OBJECT (actor),
-                               actor_data_quark, priv,
-                               free_actor_private);
-    }
+  g_ptr_array_remove_fast (priv->switch_actors, actor);
+  if (priv->switch_actors->len > 0)
+    return;
 
-  return priv;
+  /* Last one in, mutter now hides the old workspace's windows */
+  g_ptr_array_unref (priv->switch_actors);
+  priv->switch_actors = NULL;
+  meta_plugin_switch_workspace_completed (plugin);
 }
 
-void
-on_switch_workspace_effect_complete (ClutterTimeline *timeline, gpointer data)
+typedef enum
 {
-  MetaPlugin               *plugin  = META_PLUGIN (data);
-  BudgieWMPrivate *priv = BUDGIE_WM (plugin)->priv;
-  MetaScreen *screen = meta_plugin_get_screen (plugin);
-  GList *l = meta_get_window_actors (screen);
+  MATCH_GEOMETRY, /* Unchanged */
+  MATCH_SIZE,     /* Moved */
+  MATCH_ANY       /* Resized */
+} MonitorMatch;
+
+/*
+ * Hand unclaimed backgrounds to unclaimed monitors, for those pairs that
+ * are at least as close as the match asks for.
+ */
+static void
+match_backgrounds (MetaScreen   *screen,
+                   GPtrArray    *old_bgs,
+                   ClutterActor **assigned,
+                   int           n_monitors,
+                   MonitorMatch  match)
+{
+  int i;
+  guint j;
 
-  while (l)
+  for (i = 0; i < n_monitors; i++)
     {
-      ClutterActor *a = l->data;
-      MetaWindowActor *window_actor = META_WINDOW_ACTOR (a);
-      ActorPrivate *apriv = get_actor_private (window_actor);
+      MetaRectangle rect;
+
+      if (assigned[i])
+        continue;
 
-      if (apriv->orig_parent)
+      meta_screen_get_monitor_geometry (screen, i, &rect);
+      for (j = 0; j < old_bgs->len; j++)
         {
-          clutter_actor_reparent (a, apriv->orig_parent);
-          apriv->orig_parent = NULL;
+          ClutterActor *bg = g_ptr_array_index (old_bgs, j);
+          gfloat x, y, width, height;
+
+          clutter_actor_get_position (bg, &x, &y);
+          clutter_actor_get_size (bg, &width, &height);
+
+          if (match <= MATCH_SIZE &&
+              ((int) width != rect.width || (int) height != rect.height))
+            continue;
+          if (match == MATCH_GEOMETRY &&
+              ((int) x != rect.x || (int) y != rect.y))
+            continue;
+
+          assigned[i] = bg;
+          g_ptr_array_remove_index (old_bgs, j);
+          break;
         }
-
-      l = l->next;
     }
-
-  clutter_actor_destroy (priv->desktop1);
-  clutter_actor_destroy (priv->desktop2);
-
-  priv->tml_switch_workspace1 = NULL;
-  priv->tml_switch_workspace2 = NULL;
-  priv->desktop1 = NULL;
-  priv->desktop2 = NULL;
-
-  meta_plugin_switch_workspace_completed (plugin);
 }
 
+/*
+ * Monitors are matched up with the backgrounds we already have by their
+ * geometry, mutter doesn't tell us about connectors. Backgrounds are only
+ * created or destroyed for monitors that came or went, the rest follow
+ * their monitor and keep their textures where they can.
+ */
 void
 on_monitors_changed (MetaScreen *screen,
                      MetaPlugin *plugin)
 {
   BudgieWM *self = BUDGIE_WM (plugin);
+  GPtrArray *old_bgs;
+  ClutterActor **assigned;
+  ClutterActor *child;
   int i, n;
-  clutter_actor_destroy_all_children (self->priv->background_group);
-
+  guint j;
 
   n = meta_screen_get_n_monitors (screen);
+  assigned = g_new0 (ClutterActor *, n);
+
+  old_bgs = g_ptr_array_new ();
+  for (child = clutter_actor_get_first_child (self->priv->background_group);
+       child != NULL;
+       child = clutter_actor_get_next_sibling (child))
+    g_ptr_array_add (old_bgs, child);
+
+  match_backgrounds (screen, old_bgs, assigned, n, MATCH_GEOMETRY);
+  match_backgrounds (screen, old_bgs, assigned, n, MATCH_SIZE);
+  match_backgrounds (screen, old_bgs, assigned, n, MATCH_ANY);
+
   for (i = 0; i < n; i++)
     {
-      ClutterActor *bg = budgie_background_new(screen, i);
+      ClutterActor *bg = assigned[i];
+
+      if (bg)
+        {
+          budgie_background_set_monitor (BUDGIE_BACKGROUND (bg), i);
+          continue;
+        }
+      bg = budgie_background_new(screen, i);
       clutter_actor_add_child(self->priv->background_group, bg);
       clutter_actor_show(bg);
     }
+
+  /* Monitors that went away */
+  for (j = 0; j < old_bgs->len; j++)
+    clutter_actor_destroy (g_ptr_array_index (old_bgs, j));
+
+  g_ptr_array_unref (old_bgs);
+  g_free (assigned);
 }
 
-void
-switch_workspace (MetaPlugin *plugin,
-                  gint from, gint to,
-                  MetaMotionDirection direction)
+/*
+ * Slide the windows of one workspace out and those of the other in.
+ * Sticky windows stay put, and nothing else is touched.
+ */
+static void
+slide_workspace (MetaPlugin    *plugin,
+                 MetaWorkspace *workspace,
+                 gboolean       incoming,
+                 gfloat         dx,
+                 gfloat         dy,
+                 guint          duration)
 {
-  MetaScreen *screen;
   BudgieWMPrivate *priv = BUDGIE_WM (plugin)->priv;
-  GList        *l;
-  ClutterActor *workspace0  = clutter_group_new ();
-  ClutterActor *workspace1  = clutter_group_new ();
-  ClutterActor *stage;
-  int           screen_width, screen_height;
-  ClutterAnimation *animation;
-
-  screen = meta_plugin_get_screen (plugin);
-  stage = meta_get_stage_for_screen (screen);
+  GList           *windows, *l;
 
-  meta_screen_get_size (screen,
-                        &screen_width,
-                        &screen_height);
+  windows = meta_workspace_list_windows (workspace);
+  for (l = windows; l; l = l->next)
+    {
+      MetaWindow   *window = l->data;
+      ClutterActor *actor  = meta_window_get_compositor_private (window);
 
-  clutter_actor_set_anchor_point (workspace1,
-                                  screen_width,
-                                  screen_height);
-  clutter_actor_set_position (workspace1,
-                              screen_width,
-                              screen_height);
+      if (!actor
+          || meta_window_is_on_all_workspaces (window)
+          || !meta_window_showing_on_its_workspace (window))
+        continue;
 
-  clutter_actor_set_scale (workspace1, 0.0, 0.0);
+      if (incoming)
+        {
+          budgie_animation_set (actor, BUDGIE_ANIM_TRANSLATION_X, dx, 0.0);
+          budgie_animation_set (actor, BUDGIE_ANIM_TRANSLATION_Y, dy, 0.0);
+          clutter_actor_show (actor);
+        }
+      else
+        {
+          budgie_animation_set (actor, BUDGIE_ANIM_TRANSLATION_X, 0.0, -dx);
+          budgie_animation_set (actor, BUDGIE_ANIM_TRANSLATION_Y, 0.0, -dy);
+        }
 
-  clutter_container_add_actor (CLUTTER_CONTAINER (stage), workspace1);
-  clutter_container_add_actor (CLUTTER_CONTAINER (stage), workspace0);
+      g_ptr_array_add (priv->switch_actors, actor);
+      budgie_animation_run_batched (actor, duration, CLUTTER_EASE_OUT_QUAD,
+                                    on_switch_actor_done, plugin);
+    }
+  g_list_free (windows);
+}
 
-  if (from == to)
+void
+switch_workspace (MetaPlugin *plugin,
+                  gint from, gint to,
+                  MetaMotionDirection direction)
+{
+  MetaScreen      *screen = meta_plugin_get_screen (plugin);
+  BudgieWMPrivate *priv   = BUDGIE_WM (plugin)->priv;
+  int              screen_width, screen_height;
+  gfloat           dx = 0.0, dy = 0.0;
+  guint            duration;
+
+  duration = budgie_animation_get_duration (BUDGIE_EFFECT_SWITCH_WORKSPACE);
+  if (from == to || duration == 0)
     {
       meta_plugin_switch_workspace_completed (plugin);
       return;
     }
 
-  l = g_list_last (meta_get_window_actors (screen));
+  meta_screen_get_size (screen, &screen_width, &screen_height);
 
-  while (l)
+  /* The new workspace comes in from where it lies */
+  switch (direction)
     {
-      MetaWindowActor *window_actor = l->data;
-      ActorPrivate    *apriv        = get_actor_private (window_actor);
-      ClutterActor    *actor        = CLUTTER_ACTOR (window_actor);
-      MetaWorkspace   *workspace;
-      gint             win_workspace;
+    case META_MOTION_UP:
+      dy = -screen_height;
+      break;
+    case META_MOTION_DOWN:
+      dy = screen_height;
+      break;
+    case META_MOTION_LEFT:
+      dx = -screen_width;
+      break;
+    case META_MOTION_RIGHT:
+      dx = screen_width;
+      break;
+    case META_MOTION_UP_LEFT:
+      dx = -screen_width;
+      dy = -screen_height;
+      break;
+    case META_MOTION_UP_RIGHT:
+      dx = screen_width;
+      dy = -screen_height;
+      break;
+    case META_MOTION_DOWN_LEFT:
+      dx = -screen_width;
+      dy = screen_height;
+      break;
+    case META_MOTION_DOWN_RIGHT:
+      dx = screen_width;
+      dy = screen_height;
+      break;
+    }
 
-      workspace = meta_window_get_workspace (meta_window_actor_get_meta_window (window_actor));
-      win_workspace = meta_workspace_index (workspace);
+  /* Sentinel, so nothing completes the switch before both sides are in */
+  priv->switch_actors = g_ptr_array_new ();
+  g_ptr_array_add (priv->switch_actors, plugin);
 
-      if (win_workspace == to || win_workspace == from)
-        {
-          apriv->orig_parent = clutter_actor_get_parent (actor);
+  slide_workspace (plugin, meta_screen_get_workspace_by_index (screen, from),
+                   FALSE, dx, dy, duration);
+  slide_workspace (plugin, meta_screen_get_workspace_by_index (screen, to),
+                   TRUE, dx, dy, duration);
 
-          clutter_actor_reparent (actor,
-                  win_workspace == to ? workspace1 : workspace0);
-          clutter_actor_show_all (actor);
-          clutter_actor_raise_top (actor);
-        }
-      else if (win_workspace < 0)
-        {
-          /* Sticky window */
-          apriv->orig_parent = NULL;
-        }
-      else
-        {
-          /* Window on some other desktop */
-          clutter_actor_hide (actor);
-          apriv->orig_parent = NULL;
-        }
-
-      l = l->prev;
+  g_ptr_array_remove_fast (priv->switch_actors, plugin);
+  if (priv->switch_actors->len == 0)
+    {
+      g_ptr_array_unref (priv->switch_actors);
+      priv->switch_actors = NULL;
+      meta_plugin_switch_workspace_completed (plugin);
     }
-
-  priv->desktop1 = workspace0;
-  priv->desktop2 = workspace1;
-
-  animation = clutter_actor_animate (workspace0, CLUTTER_EASE_IN_SINE,
-                                     SWITCH_TIMEOUT,
-                                     "scale-x", 1.0,
-                                     "scale-y", 1.0,
-                                     NULL);
-  priv->tml_switch_workspace1 = clutter_animation_get_timeline (animation);
-  g_signal_connect (priv->tml_switch_workspace1,
-                    "completed",
-                    G_CALLBACK (on_switch_workspace_effect_complete),
-                    plugin);
-
-  animation = clutter_actor_animate (workspace1, CLUTTER_EASE_IN_SINE,
-                                     SWITCH_TIMEOUT,
-                                     "scale-x", 0.0,
-                                     "scale-y", 0.0,
-                                     NULL);
-  priv->tml_switch_workspace2 = clutter_animation_get_timeline (animation);
 }
 
 /*
@@ -327,11 +382,16 @@ kill_switch_workspace (MetaPlugin     *plugin)
 {
   BudgieWMPrivate *priv = BUDGIE_WM (plugin)->priv;
 
-  if (priv->tml_switch_workspace1)
+  /* The last one to complete completes the switch, and drops the array */
+  while (priv->switch_actors)
     {
-      clutter_timeline_stop (priv->tml_switch_workspace1);
-      clutter_timeline_stop (priv->tml_switch_workspace2);
-      g_signal_emit_by_name (priv->tml_switch_workspace1, "completed", NULL);
+      ClutterActor *actor = g_ptr_array_index (priv->switch_actors, 0);
+
+      budgie_animation_cancel (actor);
+      /* Never spin on an actor that somehow wasn't animating */
+      if (priv->switch_actors
+          && g_ptr_array_index (priv->switch_actors, 0) == actor)
+        on_switch_actor_done (actor, plugin);
     }
 }
 
@@ -339,27 +399,7 @@ void
 kill_window_effects (MetaPlugin      *plugin,
                      MetaWindowActor *window_actor)
 {
-  ActorPrivate *apriv;
-
-  apriv = get_actor_private (window_actor);
-
-  if (apriv->tml_minimize)
-    {
-      clutter_timeline_stop (apriv->tml_minimize);
-      g_signal_emit_by_name (apriv->tml_minimize, "completed", NULL);
-    }
-
-  if (apriv->tml_map)
-    {
-      clutter_timeline_stop (apriv->tml_map);
-      g_signal_emit_by_name (apriv->tml_map, "completed", NULL);
-    }
-
-  if (apriv->tml_destroy)
-    {
-      clutter_timeline_stop (apriv->tml_destroy);
-      g_signal_emit_by_name (apriv->tml_destroy, "completed", NULL);
-    }
+  budgie_animation_cancel (CLUTTER_ACTOR (window_actor));
 }
 
 static void
@@ -21,28 +21,6 @@
 
 #pragma once
 
-/*
- * Per actor private data we attach to each actor.
- */
-typedef struct _ActorPrivate
-{
-  ClutterActor *orig_parent;
-
-  ClutterTimeline *tml_minimize;
-  ClutterTimeline *tml_destroy;
-  ClutterTimeline *tml_map;
-} ActorPrivate;
-
-/* callback data for when animations complete */
-typedef struct
-{
-  ClutterActor *actor;
-  MetaPlugin *plugin;
-} EffectCompleteData;
-
-
-ActorPrivate *get_actor_private (MetaWindowActor *actor);
-
 void
 on_monitors_changed (MetaScreen *screen,
                      MetaPlugin *plugin);
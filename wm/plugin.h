@@ -46,12 +46,11 @@ typedef struct _BudgieWMPrivate BudgieWMPrivate;
  */
 struct _BudgieWMPrivate
 {
-        /* Valid only when switch_workspace effect is in progress */
-        ClutterTimeline       *tml_switch_workspace1;
-        ClutterTimeline       *tml_switch_workspace2;
-        ClutterActor          *desktop1;
-        ClutterActor          *desktop2;
+        /* Window actors still sliding, valid only when switch_workspace
+         * effect is in progress */
+        GPtrArray             *switch_actors;
         ClutterActor          *background_group;
+        GDBusConnection       *session_bus;
         MetaPluginInfo         info;
 };
 
@@ -15,8 +15,15 @@
 #include <meta/meta-background.h>
 #include <meta/meta-background-group.h>
 #include <meta/meta-version.h>
+#include <meta/meta-plugin.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
 
+#include "plugin.h"
 #include "background.h"
+#include "impl/animation.h"
 
 #define BACKGROUND_SCHEMA "org.gnome.desktop.background"
 #define PICTURE_URI_KEY   "picture-uri"
@@ -26,17 +33,58 @@
 #define BACKGROUND_STYLE_KEY "picture-options"
 #define GNOME_COLOR_HACK "gnome-control-center/pixmaps/noise-texture-light.png"
 
+#define LOW_MEMORY_KEY "low-memory-backgrounds"
+#define CROSSFADE_KEY  "background-crossfade"
+
 #define BACKGROUND_TIMEOUT 850
 
+/* Settings tools change several keys in a row, wait for the lot (ms) */
+#define BACKGROUND_UPDATE_DELAY 100
+
+/* Seconds an unused background is kept around, i.e. across a hotplug */
+#define BACKGROUND_CACHE_LINGER 30
+
+/* Most scaled wallpapers kept in the user's cache, least recently used go first */
+#define SCALED_CACHE_SIZE 16
+
+/* Length of the strip a low memory gradient is drawn into */
+#define GRADIENT_STEPS 256
+
+/**
+ * A configured MetaBackground, shared by every monitor showing the same
+ * thing at the same size, so the wallpaper is only decoded and uploaded
+ * once.
+ */
+typedef struct {
+        gchar *key;
+        MetaBackground *background;
+        guint users;
+        guint expire_id;
+        gboolean loaded;
+} BackgroundCacheEntry;
+
+static GHashTable *background_cache = NULL;
+
 struct _BudgieBackgroundPrivate
 {
         MetaScreen *screen;
         GSettings *settings;
+        GSettings *wm_settings;
         ClutterActor *bg;
         ClutterActor *old_bg;
+        ClutterActor *fading; /* bg while it's fading in, only compared */
+        BackgroundCacheEntry *entry;
+        gulong changed_id;
+        guint update_id;
         int index;
+        int monitor; /* Monitor bg was created for */
+        gchar *key; /* What bg shows, see _update */
+        gboolean low_memory;
+        gboolean crossfade;
 };
 static void _update(BudgieBackground *self);
+static void release_background(BudgieBackground *self);
+static void on_entry_changed(MetaBackground *background, BackgroundCacheEntry *entry);
 
 G_DEFINE_TYPE_WITH_PRIVATE(BudgieBackground, budgie_background, META_TYPE_BACKGROUND_GROUP)
 
@@ -116,9 +164,22 @@ static void budgie_background_class_init(BudgieBackgroundClass *klass)
                 obj_properties);
 }
 
-static void on_key_change(GSettings *settings, const gchar *key, BudgieBackground *self)
+static gboolean update_timeout(gpointer data)
 {
+        BudgieBackground *self = data;
+
+        self->priv->update_id = 0;
         _update(self);
+        return FALSE;
+}
+
+static void on_key_change(GSettings *settings, const gchar *key, BudgieBackground *self)
+{
+        /* One update for the whole burst */
+        if (self->priv->update_id > 0) {
+                g_source_remove(self->priv->update_id);
+        }
+        self->priv->update_id = g_timeout_add(BACKGROUND_UPDATE_DELAY, update_timeout, self);
 }
 
 static GObject* budgie_background_construct(GType type, guint n_props, GObjectConstructParam *props)
@@ -137,6 +198,8 @@ static GObject* budgie_background_construct(GType type, guint n_props, GObjectCo
         clutter_actor_set_size(CLUTTER_ACTOR(self), rect.width, rect.height);
 
         g_signal_connect(self->priv->settings, "changed", G_CALLBACK(on_key_change), self);
+        g_signal_connect(self->priv->wm_settings, "changed::" LOW_MEMORY_KEY, G_CALLBACK(on_key_change), self);
+        g_signal_connect(self->priv->wm_settings, "changed::" CROSSFADE_KEY, G_CALLBACK(on_key_change), self);
         _update(self);
 
         return o;
@@ -147,41 +210,448 @@ static void budgie_background_init(BudgieBackground *self)
         /* Initial boilerplate cruft. */
         self->priv = budgie_background_get_instance_private(self);
         self->priv->settings = g_settings_new(BACKGROUND_SCHEMA);
+        self->priv->wm_settings = g_settings_new(BUDGIE_WM_SCHEMA);
 
         clutter_actor_set_background_color(CLUTTER_ACTOR(self),
                 clutter_color_get_static(CLUTTER_COLOR_BLACK));
 }
 
-static void remove_old(ClutterActor *actor, BudgieBackground *self)
+static void remove_old(ClutterActor *actor, gpointer data)
 {
-        /* When transition is complete just kill the actor */
-        clutter_actor_destroy(actor);
-        self->priv->old_bg = NULL;
-}
+        BudgieBackground *self = data;
 
-static void begin_remove_old(ClutterActor *actor, BudgieBackground *self)
-{
-        /* Animate old fella out. */
-        if (self->priv->old_bg && self->priv->old_bg != self->priv->bg) {
-                g_signal_connect(self->priv->old_bg, "transitions-completed", G_CALLBACK(remove_old), self);
-                clutter_actor_save_easing_state(self->priv->old_bg);
-                clutter_actor_set_easing_mode(self->priv->old_bg, CLUTTER_EASE_OUT_QUAD);
-                clutter_actor_set_easing_duration(self->priv->old_bg, BACKGROUND_TIMEOUT);
-                g_object_set(self->priv->old_bg, "opacity", 0, NULL);
-                clutter_actor_restore_easing_state(self->priv->old_bg);
+        if (actor == self->priv->fading) {
+                self->priv->fading = NULL;
+        }
+        /* Superseded before it made it all the way in */
+        if (actor != self->priv->bg) {
+                return;
+        }
+        /* New fella is fully in and covers the old one, just kill it */
+        if (self->priv->old_bg) {
+                clutter_actor_destroy(self->priv->old_bg);
+                self->priv->old_bg = NULL;
         }
 }
 
 static void on_update(MetaBackground *background, BudgieBackground *self)
 {
+        ClutterActor *bg = self->priv->bg;
+
+        /* Reloads (i.e. monitor changes) emit this again mid-fade. Restarting
+         * would complete the fade first and drop old_bg from under a still
+         * translucent bg, so just let it carry on. */
+        if (bg == self->priv->fading) {
+                return;
+        }
+        if (!self->priv->old_bg && clutter_actor_get_opacity(bg) == 255) {
+                return;
+        }
+        self->priv->fading = bg;
+
         /* Animate new fella in */
-        clutter_actor_save_easing_state(self->priv->bg);
-        g_signal_connect(self->priv->bg, "transitions-completed", G_CALLBACK(begin_remove_old), self);
-        clutter_actor_set_easing_mode(self->priv->bg, CLUTTER_EASE_IN_EXPO);
-        clutter_actor_set_easing_duration(self->priv->bg, BACKGROUND_TIMEOUT);
-        g_object_set(self->priv->bg, "opacity", 255, NULL);
-        clutter_actor_restore_easing_state(self->priv->bg);
+        budgie_animation_set(bg, BUDGIE_ANIM_OPACITY, clutter_actor_get_opacity(bg), 255);
+        budgie_animation_run(bg, budgie_animation_enabled() && self->priv->crossfade ? BACKGROUND_TIMEOUT : 0,
+                CLUTTER_EASE_IN_EXPO, remove_old, self);
+}
+
+static void free_cache_entry(gpointer data)
+{
+        BackgroundCacheEntry *entry = data;
+
+        if (entry->expire_id > 0) {
+                g_source_remove(entry->expire_id);
+        }
+        /* Actors may still be showing it for a moment */
+        g_signal_handlers_disconnect_by_func(entry->background, on_entry_changed, entry);
+        g_object_unref(entry->background);
+        g_free(entry->key);
+        g_slice_free(BackgroundCacheEntry, entry);
+}
+
+static gboolean expire_cache_entry(gpointer data)
+{
+        BackgroundCacheEntry *entry = data;
+
+        entry->expire_id = 0;
+        g_hash_table_remove(background_cache, entry->key);
+        return FALSE;
+}
+
+static void on_entry_changed(MetaBackground *background, BackgroundCacheEntry *entry)
+{
+        entry->loaded = TRUE;
+}
+
+static gboolean is_color_background(const gchar *bg_filename, GDesktopBackgroundStyle style)
+{
+        return style == G_DESKTOP_BACKGROUND_STYLE_NONE || g_str_has_suffix(bg_filename, GNOME_COLOR_HACK);
+}
+
+static void set_background_file(MetaBackground *background, const gchar *filename,
+                                GDesktopBackgroundStyle style)
+{
+#if META_MINOR_VERSION > 14
+        GFile *file = g_file_new_for_path(filename);
+        meta_background_set_file(background, file, style);
+        g_object_unref(file);
+#else
+        meta_background_set_filename(background, filename, style);
+#endif
 }
+
+/**
+ * Size worth decoding an image at to cover a width x height area the way
+ * style draws it. FALSE if that's no smaller than the image itself.
+ */
+static gboolean decode_size(GDesktopBackgroundStyle style, int width, int height,
+                            int image_width, int image_height,
+                            int *decode_width, int *decode_height)
+{
+        gdouble scale;
+
+        switch (style) {
+                case G_DESKTOP_BACKGROUND_STYLE_STRETCHED:
+                        *decode_width = MIN(width, image_width);
+                        *decode_height = MIN(height, image_height);
+                        return *decode_width < image_width || *decode_height < image_height;
+                case G_DESKTOP_BACKGROUND_STYLE_SCALED:
+                        scale = MIN((gdouble)width / image_width, (gdouble)height / image_height);
+                        break;
+                case G_DESKTOP_BACKGROUND_STYLE_ZOOM:
+                case G_DESKTOP_BACKGROUND_STYLE_SPANNED:
+                        scale = MAX((gdouble)width / image_width, (gdouble)height / image_height);
+                        break;
+                default:
+                        /* Tiled and centred are drawn at their own size */
+                        return FALSE;
+        }
+        if (scale >= 1.0) {
+                return FALSE;
+        }
+        *decode_width = MAX(1, (int)(image_width * scale + 0.5));
+        *decode_height = MAX(1, (int)(image_height * scale + 0.5));
+        return TRUE;
+}
+
+typedef struct {
+        gchar *source;
+        gchar *target;
+        gchar *prefix; /* Shared by every copy of the same source */
+        gchar *version; /* Shared by the copies of its current contents */
+        int width;
+        int height;
+        GDesktopBackgroundStyle style;
+} ScaledImage;
+
+static void free_scaled_image(gpointer data)
+{
+        ScaledImage *image = data;
+
+        g_free(image->source);
+        g_free(image->target);
+        g_free(image->prefix);
+        g_free(image->version);
+        g_slice_free(ScaledImage, image);
+}
+
+typedef struct {
+        gchar *path;
+        time_t mtime;
+} CachedImage;
+
+static gint cached_image_compare(gconstpointer a, gconstpointer b)
+{
+        const CachedImage *ca = a, *cb = b;
+
+        /* Newest first */
+        return (cb->mtime > ca->mtime) - (cb->mtime < ca->mtime);
+}
+
+/**
+ * Remove copies of a previous version of this wallpaper, and then the
+ * least recently used copies of any, so the cache doesn't grow forever.
+ */
+static void prune_scaled_images(ScaledImage *image)
+{
+        gchar *dirname = g_path_get_dirname(image->target);
+        GDir *dir = NULL;
+        const gchar *name = NULL;
+        GSList *images = NULL, *elem = NULL;
+        guint n_images = 0;
+
+        dir = g_dir_open(dirname, 0, NULL);
+        if (!dir) {
+                g_free(dirname);
+                return;
+        }
+        while ((name = g_dir_read_name(dir))) {
+                gchar *path = NULL;
+                GStatBuf st;
+                CachedImage *cached = NULL;
+
+                /* Leave anything half written by another thread alone */
+                if (!g_str_has_suffix(name, ".png")) {
+                        continue;
+                }
+                path = g_build_filename(dirname, name, NULL);
+                if (g_str_has_prefix(name, image->prefix) &&
+                        !g_str_has_prefix(name + strlen(image->prefix), image->version)) {
+                        g_unlink(path);
+                        g_free(path);
+                        continue;
+                }
+                if (g_stat(path, &st) != 0) {
+                        g_free(path);
+                        continue;
+                }
+                cached = g_slice_new(CachedImage);
+                cached->path = path;
+                cached->mtime = st.st_mtime;
+                images = g_slist_prepend(images, cached);
+        }
+        g_dir_close(dir);
+        g_free(dirname);
+
+        images = g_slist_sort(images, cached_image_compare);
+        for (elem = images; elem; elem = elem->next) {
+                CachedImage *cached = elem->data;
+
+                if (++n_images > SCALED_CACHE_SIZE && g_strcmp0(cached->path, image->target) != 0) {
+                        g_unlink(cached->path);
+                }
+                g_free(cached->path);
+                g_slice_free(CachedImage, cached);
+        }
+        g_slist_free(images);
+}
+
+static void scale_image_thread(GTask *task, gpointer source, gpointer data, GCancellable *cancel)
+{
+        ScaledImage *image = data;
+        GdkPixbuf *pixbuf = NULL;
+        GError *error = NULL;
+        gchar *dir = NULL;
+        gchar *tmp = NULL;
+
+        pixbuf = gdk_pixbuf_new_from_file_at_scale(image->source, image->width,
+                image->height, FALSE, &error);
+        if (pixbuf) {
+                dir = g_path_get_dirname(image->target);
+                g_mkdir_with_parents(dir, 0700);
+                g_free(dir);
+
+                /* Moved into place once complete, nobody sees it half written */
+                tmp = g_strdup_printf("%s.%u.tmp", image->target, g_random_int());
+                if (gdk_pixbuf_save(pixbuf, tmp, "png", &error, NULL) &&
+                        g_rename(tmp, image->target) != 0) {
+                        int err = errno;
+                        g_set_error_literal(&error, G_IO_ERROR, g_io_error_from_errno(err),
+                                g_strerror(err));
+                }
+                if (error) {
+                        g_unlink(tmp);
+                } else {
+                        prune_scaled_images(image);
+                }
+                g_free(tmp);
+                g_object_unref(pixbuf);
+        }
+        if (error) {
+                g_task_return_error(task, error);
+        } else {
+                g_task_return_boolean(task, TRUE);
+        }
+}
+
+static void scale_image_done(GObject *source, GAsyncResult *result, gpointer data)
+{
+        ScaledImage *image = g_task_get_task_data(G_TASK(result));
+        GError *error = NULL;
+
+        if (!g_task_propagate_boolean(G_TASK(result), &error)) {
+                g_message("Unable to scale background %s: %s", image->source, error->message);
+                g_error_free(error);
+                set_background_file(META_BACKGROUND(source), image->source, image->style);
+                return;
+        }
+        set_background_file(META_BACKGROUND(source), image->target, image->style);
+}
+
+/**
+ * Load the wallpaper decoded no larger than it'll be shown at. The scaled
+ * copy is written to the user's cache once, in a thread, and reused until
+ * the wallpaper itself changes.
+ */
+static void set_background_file_scaled(MetaBackground *background, const gchar *filename,
+                                       GDesktopBackgroundStyle style, int width, int height)
+{
+        ScaledImage *image = NULL;
+        GTask *task = NULL;
+        GStatBuf source_st;
+        int image_width, image_height;
+        int decode_width, decode_height;
+        gchar *name = NULL;
+
+        if (g_stat(filename, &source_st) != 0 ||
+                !gdk_pixbuf_get_file_info(filename, &image_width, &image_height) ||
+                !decode_size(style, width, height, image_width, image_height,
+                        &decode_width, &decode_height)) {
+                set_background_file(background, filename, style);
+                return;
+        }
+
+        image = g_slice_new0(ScaledImage);
+        image->source = g_strdup(filename);
+        image->width = decode_width;
+        image->height = decode_height;
+        image->style = style;
+
+        /* A rewritten wallpaper gets a new copy, replacing the old one */
+        name = g_compute_checksum_for_string(G_CHECKSUM_MD5, filename, -1);
+        image->prefix = g_strconcat(name, "-", NULL);
+        image->version = g_strdup_printf("%" G_GINT64_FORMAT "-", (gint64)source_st.st_mtime);
+        g_free(name);
+        name = g_strdup_printf("%s%s%dx%d.png", image->prefix, image->version,
+                decode_width, decode_height);
+        image->target = g_build_filename(g_get_user_cache_dir(), "budgie-wm",
+                "backgrounds", name, NULL);
+        g_free(name);
+
+        /* Scaled last time round, mark it as recently used */
+        if (g_file_test(image->target, G_FILE_TEST_IS_REGULAR)) {
+                g_utime(image->target, NULL);
+                set_background_file(background, image->target, style);
+                free_scaled_image(image);
+                return;
+        }
+
+        task = g_task_new(background, NULL, scale_image_done, NULL);
+        g_task_set_task_data(task, image, free_scaled_image);
+        g_task_run_in_thread(task, scale_image_thread);
+        g_object_unref(task);
+}
+
+/**
+ * Set up a new background from the current settings. With a non-zero
+ * width and height the wallpaper is decoded at no more than that size.
+ */
+static void configure_background(MetaBackground *background, const gchar *bg_filename,
+                                 GDesktopBackgroundStyle style,
+                                 GDesktopBackgroundShading shading_direction,
+                                 ClutterColor *primary_color,
+                                 ClutterColor *secondary_color,
+                                 int width, int height)
+{
+        GFile *bg_file = NULL;
+        char *filename = NULL;
+
+        if (is_color_background(bg_filename, style)) {
+                if (shading_direction == G_DESKTOP_BACKGROUND_SHADING_SOLID) {
+                        meta_background_set_color(background, primary_color);
+                } else {
+                        meta_background_set_gradient(background, shading_direction,
+                                primary_color, secondary_color);
+                }
+                return;
+        }
+
+        /* Load up the new wallpaper */
+        bg_file = g_file_new_for_uri(bg_filename);
+        filename = g_file_get_path(bg_file);
+        if (!filename) {
+                g_message("Note: File does not exist...");
+        } else if (width > 0 && height > 0) {
+                set_background_file_scaled(background, filename, style, width, height);
+        } else {
+                set_background_file(background, filename, style);
+        }
+        g_free(filename);
+        g_object_unref(bg_file);
+}
+
+static gboolean draw_gradient(ClutterCanvas *canvas, cairo_t *cr, int width, int height,
+                              gpointer data)
+{
+        ClutterColor *colors = data;
+        cairo_pattern_t *pattern = NULL;
+
+        /* One of width or height is a single pixel */
+        pattern = cairo_pattern_create_linear(0, 0, width > 1 ? width : 0, height > 1 ? height : 0);
+        cairo_pattern_add_color_stop_rgba(pattern, 0, colors[0].red / 255.0,
+                colors[0].green / 255.0, colors[0].blue / 255.0, colors[0].alpha / 255.0);
+        cairo_pattern_add_color_stop_rgba(pattern, 1, colors[1].red / 255.0,
+                colors[1].green / 255.0, colors[1].blue / 255.0, colors[1].alpha / 255.0);
+
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source(cr, pattern);
+        cairo_paint(cr);
+        cairo_pattern_destroy(pattern);
+
+        return TRUE;
+}
+
+/**
+ * Plain colour backgrounds without a monitor sized texture. Solid colours
+ * are just the actor's background colour, gradients a single strip that
+ * the GPU stretches over the monitor.
+ */
+static ClutterActor *color_background_new(GDesktopBackgroundShading shading_direction,
+                                          ClutterColor *primary_color,
+                                          ClutterColor *secondary_color)
+{
+        ClutterActor *actor = clutter_actor_new();
+        ClutterContent *canvas = NULL;
+        ClutterColor *colors = NULL;
+
+        if (shading_direction == G_DESKTOP_BACKGROUND_SHADING_SOLID) {
+                clutter_actor_set_background_color(actor, primary_color);
+                return actor;
+        }
+
+        colors = g_new(ClutterColor, 2);
+        colors[0] = *primary_color;
+        colors[1] = *secondary_color;
+
+        canvas = clutter_canvas_new();
+        g_signal_connect_data(canvas, "draw", G_CALLBACK(draw_gradient), colors,
+                (GClosureNotify)g_free, 0);
+        if (shading_direction == G_DESKTOP_BACKGROUND_SHADING_VERTICAL) {
+                clutter_canvas_set_size(CLUTTER_CANVAS(canvas), 1, GRADIENT_STEPS);
+        } else {
+                clutter_canvas_set_size(CLUTTER_CANVAS(canvas), GRADIENT_STEPS, 1);
+        }
+
+        clutter_actor_set_content(actor, canvas);
+        clutter_actor_set_content_gravity(actor, CLUTTER_CONTENT_GRAVITY_RESIZE_FILL);
+        clutter_actor_set_content_scaling_filters(actor, CLUTTER_SCALING_FILTER_LINEAR,
+                CLUTTER_SCALING_FILTER_LINEAR);
+        g_object_unref(canvas);
+
+        return actor;
+}
+
+/**
+ * Monitor whose texture we paint. Same sized monitors render the same
+ * thing, unless the wallpaper spans them all, so they can share one.
+ */
+static int texture_monitor(MetaScreen *screen, int index, GDesktopBackgroundStyle style)
+{
+        MetaRectangle rect, other;
+
+        if (style == G_DESKTOP_BACKGROUND_STYLE_SPANNED) {
+                return index;
+        }
+        meta_screen_get_monitor_geometry(screen, index, &rect);
+        for (int i = 0; i < index; i++) {
+                meta_screen_get_monitor_geometry(screen, i, &other);
+                if (other.width == rect.width && other.height == rect.height) {
+                        return i;
+                }
+        }
+        return index;
+}
+
 /**
  * Actually update our appearance..
  * ATM this is totally hacky and only uses picture-uri :P
@@ -189,92 +659,212 @@ static void on_update(MetaBackground *background, BudgieBackground *self)
 static void _update(BudgieBackground *self)
 {
         ClutterActor *actor = NULL;
-        MetaBackground *background = NULL;
+        BackgroundCacheEntry *entry = NULL;
         MetaRectangle rect;
-        GFile *bg_file = NULL;
         GDesktopBackgroundStyle style;
         GDesktopBackgroundShading  shading_direction;
         ClutterColor primary_color;
         ClutterColor secondary_color;
-        gchar *color_str = NULL;
+        gchar *primary_str = NULL;
+        gchar *secondary_str = NULL;
+        gchar *key = NULL;
+        gboolean low_memory;
+        int monitor;
 
         gchar *bg_filename = g_settings_get_string(self->priv->settings,
                 PICTURE_URI_KEY);
 
         style = g_settings_get_enum(self->priv->settings, BACKGROUND_STYLE_KEY);
+        shading_direction = g_settings_get_enum(self->priv->settings, COLOR_SHADING_TYPE_KEY);
+
+        /* Primary color */
+        primary_str = g_settings_get_string(self->priv->settings, PRIMARY_COLOR_KEY);
+        clutter_color_from_string(&primary_color, primary_str);
 
-        /* Creation of replacement actor */
-        actor = meta_background_actor_new(self->priv->screen, self->priv->index);
-        background = meta_background_new(self->priv->screen);
-        meta_background_actor_set_background(META_BACKGROUND_ACTOR(actor), background);
+        /* Secondary color */
+        secondary_str = g_settings_get_string(self->priv->settings, SECONDARY_COLOR_KEY);
+        clutter_color_from_string(&secondary_color, secondary_str);
 
         meta_screen_get_monitor_geometry(self->priv->screen, self->priv->index, &rect);
+        monitor = texture_monitor(self->priv->screen, self->priv->index, style);
+
+        low_memory = g_settings_get_boolean(self->priv->wm_settings, LOW_MEMORY_KEY);
+        self->priv->crossfade = g_settings_get_boolean(self->priv->wm_settings, CROSSFADE_KEY);
+
+        /* Everything that affects what ends up in the texture */
+        key = g_strdup_printf("%s|%d|%d|%s|%s|%dx%d+%d|%d", bg_filename, style,
+                shading_direction, primary_str, secondary_str, rect.width,
+                rect.height, style == G_DESKTOP_BACKGROUND_STYLE_SPANNED ? self->priv->index : -1,
+                low_memory);
+        g_free(primary_str);
+        g_free(secondary_str);
+
+        /* Nothing we'd see changed, at most it moved along with us */
+        if (g_strcmp0(key, self->priv->key) == 0 && monitor == self->priv->monitor) {
+                if (self->priv->bg) {
+                        clutter_actor_set_position(self->priv->bg, rect.x, rect.y);
+                }
+                g_free(key);
+                g_free(bg_filename);
+                return;
+        }
+
+        /* Takes effect for the background we let go of here too */
+        self->priv->low_memory = low_memory;
+
+        if (low_memory && is_color_background(bg_filename, style)) {
+                release_background(self);
+                actor = color_background_new(shading_direction, &primary_color, &secondary_color);
+        } else {
+                if (!background_cache) {
+                        background_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_cache_entry);
+                }
+                entry = g_hash_table_lookup(background_cache, key);
+                if (!entry) {
+                        int width = 0, height = 0;
+
+                        entry = g_slice_new0(BackgroundCacheEntry);
+                        entry->key = g_strdup(key);
+                        entry->background = meta_background_new(self->priv->screen);
+                        g_signal_connect(entry->background, "changed", G_CALLBACK(on_entry_changed), entry);
+                        g_hash_table_insert(background_cache, entry->key, entry);
+
+                        if (low_memory && style == G_DESKTOP_BACKGROUND_STYLE_SPANNED) {
+                                meta_screen_get_size(self->priv->screen, &width, &height);
+                        } else if (low_memory) {
+                                width = rect.width;
+                                height = rect.height;
+                        }
+                        configure_background(entry->background, bg_filename, style,
+                                shading_direction, &primary_color, &secondary_color,
+                                width, height);
+                }
+
+                /* Take it before letting go of the old one, which may be the same */
+                entry->users++;
+                if (entry->expire_id > 0) {
+                        g_source_remove(entry->expire_id);
+                        entry->expire_id = 0;
+                }
+                release_background(self);
+                self->priv->entry = entry;
+
+                /* Creation of replacement actor */
+                actor = meta_background_actor_new(self->priv->screen, monitor);
+                meta_background_actor_set_background(META_BACKGROUND_ACTOR(actor), entry->background);
+        }
+        g_free(bg_filename);
+        g_free(self->priv->key);
+        self->priv->key = key;
+        self->priv->monitor = monitor;
+
         clutter_actor_set_position(actor, rect.x, rect.y);
         clutter_actor_set_size(actor, rect.width, rect.height);
         g_object_set(actor, "opacity", 0, NULL);
         clutter_actor_show(actor);
 
+        if (!self->priv->crossfade) {
+                /* Straight over, never holding two textures at once */
+                ClutterActor *old_bg = self->priv->old_bg;
+                ClutterActor *bg = self->priv->bg;
+
+                self->priv->old_bg = NULL;
+                self->priv->bg = NULL;
+                if (old_bg) {
+                        clutter_actor_destroy(old_bg);
+                }
+                if (bg) {
+                        clutter_actor_destroy(bg);
+                }
+        }
+
         clutter_actor_insert_child_at_index(CLUTTER_ACTOR(self), actor, -1);
-        if (self->priv->bg) {
+        if (self->priv->old_bg) {
+                /* Still fading in from last time, drop it and go again from
+                 * the fully visible one underneath */
+                ClutterActor *superseded = self->priv->bg;
+
+                self->priv->bg = NULL;
+                clutter_actor_destroy(superseded);
+        } else {
                 self->priv->old_bg = self->priv->bg;
         }
         self->priv->bg = actor;
-        g_object_unref(background);
 
-        g_signal_connect(background, "changed", G_CALLBACK(on_update), self);
-
-        shading_direction = g_settings_get_enum(self->priv->settings, COLOR_SHADING_TYPE_KEY);
-        /* Primary color */
-        color_str = g_settings_get_string(self->priv->settings, PRIMARY_COLOR_KEY);
-        if (color_str) {
-                clutter_color_from_string(&primary_color, color_str);
-                g_free(color_str);
-                color_str = NULL;
+        if (!entry) {
+                /* Nothing to load */
+                on_update(NULL, self);
+                return;
         }
-
-        /* Secondary color */
-        color_str = g_settings_get_string(self->priv->settings, SECONDARY_COLOR_KEY);
-        if (color_str) {
-                clutter_color_from_string(&secondary_color, color_str);
-                g_free(color_str);
-                color_str = NULL;
+        self->priv->changed_id = g_signal_connect(entry->background, "changed", G_CALLBACK(on_update), self);
+        /* Already up and running, no need to wait for it */
+        if (entry->loaded) {
+                on_update(entry->background, self);
         }
+}
 
-        if (style == G_DESKTOP_BACKGROUND_STYLE_NONE || g_str_has_suffix(bg_filename, GNOME_COLOR_HACK)) {
-                if (shading_direction == G_DESKTOP_BACKGROUND_SHADING_SOLID) {
-                        meta_background_set_color(background, &primary_color);
-                } else {
-                        meta_background_set_gradient(background, shading_direction,
-                                &primary_color, &secondary_color);
-                }
-        } else {
-                /* Load up the new wallpaper */
+void budgie_background_set_monitor(BudgieBackground *self, int monitor)
+{
+        MetaRectangle rect;
 
-                bg_file = g_file_new_for_uri(bg_filename);
+        self->priv->index = monitor;
+        meta_screen_get_monitor_geometry(self->priv->screen, monitor, &rect);
+        clutter_actor_set_position(CLUTTER_ACTOR(self), rect.x, rect.y);
+        clutter_actor_set_size(CLUTTER_ACTOR(self), rect.width, rect.height);
 
-#if META_MINOR_VERSION > 14
-                meta_background_set_file(background, style);
-#else
-                char *filename = g_file_get_path(bg_file);
-                if (filename) {
-                        meta_background_set_filename(background, filename, style);
-                        g_free(filename);
-                } else {
-                        g_message("Note: File does not exist...");
-                }
-#endif
-                g_object_unref(bg_file);
+        /* Only builds a new actor if the texture itself changes */
+        _update(self);
+}
+
+/**
+ * Stop using our cached background, it's kept for a little while in
+ * case somebody else wants it again.
+ */
+static void release_background(BudgieBackground *self)
+{
+        BackgroundCacheEntry *entry = self->priv->entry;
+
+        if (!entry) {
+                return;
+        }
+        g_signal_handler_disconnect(entry->background, self->priv->changed_id);
+        self->priv->changed_id = 0;
+        self->priv->entry = NULL;
+
+        if (--entry->users > 0) {
+                return;
+        }
+        if (self->priv->low_memory) {
+                /* Gone as soon as the last actor showing it is */
+                g_hash_table_remove(background_cache, entry->key);
+        } else {
+                entry->expire_id = g_timeout_add_seconds(BACKGROUND_CACHE_LINGER,
+                        expire_cache_entry, entry);
         }
-        g_free(bg_filename);
 }
 
 static void budgie_background_dispose(GObject *object)
 {
         BudgieBackground *self = BUDGIE_BACKGROUND(object);
+
+        if (self->priv->update_id > 0) {
+                g_source_remove(self->priv->update_id);
+                self->priv->update_id = 0;
+        }
+        release_background(self);
+        /* Children go with the parent, don't let the fade finish into them */
+        self->priv->bg = NULL;
+        self->priv->old_bg = NULL;
         if (self->priv->settings) {
                 g_object_unref(self->priv->settings);
                 self->priv->settings = NULL;
         }
+        if (self->priv->wm_settings) {
+                g_object_unref(self->priv->wm_settings);
+                self->priv->wm_settings = NULL;
+        }
+        g_free(self->priv->key);
+        self->priv->key = NULL;
 
         G_OBJECT_CLASS (budgie_background_parent_class)->dispose (object);
 }
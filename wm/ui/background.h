@@ -47,3 +47,11 @@ GType budgie_background_get_type(void);
  * @return A new BudgieBackground
  */
 ClutterActor *budgie_background_new(MetaScreen *screen, int monitor);
+
+/**
+ * Move the background over to another monitor, or follow its own monitor
+ * to a new geometry. Nothing is rebuilt unless the wallpaper would look
+ * different at the new size.
+ * @param monitor Index of the monitor this background now covers
+ */
+void budgie_background_set_monitor(BudgieBackground *self, int monitor);